@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace motioncam {
+
+// Pool of byte buffers for decoded frames. Buffers handed out keep their size and capacity
+// from previous use, so decoding a frame of the same dimensions into one neither allocates nor
+// zero-fills. Buffers return to the pool when the last reference goes away, up to maxBuffers of them.
+// Size it by the number of loads that run at once, buffers beyond that would only sit idle.
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+public:
+    using Buffer = std::vector<uint8_t>;
+
+    explicit BufferPool(size_t maxBuffers) : mMaxBuffers(maxBuffers), mPooledBytes(0) {}
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    std::shared_ptr<Buffer> acquire() {
+        std::unique_ptr<Buffer> buffer;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            if(!mFree.empty()) {
+                buffer = std::move(mFree.back());
+                mFree.pop_back();
+                mPooledBytes -= buffer->capacity();
+            }
+        }
+
+        if(!buffer)
+            buffer = std::make_unique<Buffer>();
+
+        std::weak_ptr<BufferPool> pool = shared_from_this();
+
+        return std::shared_ptr<Buffer>(buffer.release(), [pool](Buffer* b) {
+            if(auto p = pool.lock())
+                p->release(b);
+            else
+                delete b;
+        });
+    }
+
+    // Bytes held by buffers that are currently not in use
+    size_t pooledBytes() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        return mPooledBytes;
+    }
+
+private:
+    void release(Buffer* buffer) {
+        std::unique_ptr<Buffer> owned(buffer);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if(mFree.size() >= mMaxBuffers)
+            return;
+
+        mPooledBytes += owned->capacity();
+        mFree.push_back(std::move(owned));
+    }
+
+private:
+    const size_t mMaxBuffers;
+    size_t mPooledBytes;
+    std::vector<std::unique_ptr<Buffer>> mFree;
+    mutable std::mutex mMutex;
+};
+
+} // namespace motioncam
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace motioncam {
+
+// Log encoding dither. Blue noise tiles with a triangular distribution, one per CFA channel. A
+// channel's samples sit on their own lattice, so the tiles are indexed by lattice coordinates.
+constexpr int DITHER_SIZE = 64;
+constexpr int DITHER_MASK = DITHER_SIZE - 1;
+
+// Fractional bits of the integer dither
+constexpr int DITHER_FIXED_POINT_SHIFT = 8;
+
+using DitherTile = std::array<float, DITHER_SIZE * DITHER_SIZE>;
+using DitherTileFixed = std::array<int16_t, DITHER_SIZE * DITHER_SIZE>;
+
+// Void and cluster (Ulichney 1993) on a torus, returns the rank of every cell
+std::vector<int> voidAndClusterRanks(uint32_t seed);
+
+// Tiles are generated on first use
+const std::array<DitherTile, 4>& ditherTiles();
+
+// Same tiles with DITHER_FIXED_POINT_SHIFT fractional bits
+const std::array<DitherTileFixed, 4>& ditherTilesFixed();
+
+} // namespace motioncam
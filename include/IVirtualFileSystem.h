@@ -2,13 +2,18 @@
 
 #include "Types.h"
 
+#include <atomic>
 #include <optional>
 #include <string>
 #include <vector>
 #include <functional>
+#include <memory>
 
 namespace motioncam {
 
+// Set by the reader once it no longer wants the data, queued work for the read is then skipped
+using CancelToken = std::shared_ptr<const std::atomic<bool>>;
+
 class IVirtualFileSystem {
 public:
     virtual ~IVirtualFileSystem() = default;
@@ -24,7 +29,8 @@ public:
         const size_t len,
         void* dst,
         std::function<void(size_t, int)> result,
-        bool async) = 0;
+        bool async,
+        CancelToken cancelToken) = 0;
 
     virtual void updateOptions(const RenderSettings& settings) = 0;
 
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+namespace BS {
+class thread_pool;
+}
+
+namespace motioncam {
+
+// Orders pending loads of a single file by position (C-SCAN elevator) instead of running them in
+// request order. Every submitted job schedules one pool task, and whichever pool thread becomes free
+// runs the pending job closest ahead of the last position read. A job that has been overtaken maxBypass
+// times by jobs submitted after it runs next regardless of its position. Jobs that were pending together
+// do not count against each other, a burst is served in one sweep.
+//
+// Pool tasks share the queue, so the scheduler can go away while some of them are still queued in the pool.
+class IoScheduler {
+public:
+    using Job = std::function<void()>;
+
+    IoScheduler(BS::thread_pool& pool, size_t maxBypass = 32);
+
+    // Drops the jobs that have not started
+    ~IoScheduler();
+
+    IoScheduler(const IoScheduler&) = delete;
+    IoScheduler& operator=(const IoScheduler&) = delete;
+
+    void submit(size_t position, Job job);
+
+    // Drops the jobs that have not started and returns how many there were. Jobs that are running are
+    // not waited for.
+    size_t cancel();
+
+private:
+    struct Queue;
+
+    static void runNext(Queue& queue);
+
+private:
+    BS::thread_pool& mPool;
+    std::shared_ptr<Queue> mQueue;
+};
+
+} // namespace motioncam
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
@@ -13,9 +16,126 @@
 
 namespace motioncam {
 
+// Decides whether an entry leaving the admission window may replace the entry the main cache would evict
+// for it. Called with the cache lock held.
+class CachePolicy {
+public:
+    virtual ~CachePolicy() = default;
+
+    // Called once per read of an entry. cachedEntries is how many entries the cache holds at the moment.
+    virtual void recordAccess(const Entry& key, size_t cachedEntries) = 0;
+    virtual bool admit(const Entry& candidate, const Entry& victim) = 0;
+};
+
+// Plain LRU, every entry is admitted
+class LruPolicy : public CachePolicy {
+public:
+    void recordAccess(const Entry&, size_t) override {}
+    bool admit(const Entry&, const Entry&) override { return true; }
+};
+
+// TinyLFU admission. Access counts are kept in a count-min sketch of 4 bit counters. The counters are halved
+// after ten accesses per cached entry, so popularity follows the playhead while frames read once during a
+// scan lose against frames that are scrubbed over. Pure scrubbing over a wide range hits less often than with
+// plain LRU, so it is opt-in (USE_TINYLFU_CACHE).
+class TinyLfuPolicy : public CachePolicy {
+public:
+    explicit TinyLfuPolicy(size_t width = 4096) :
+        mCounters(roundUpPowerOfTwo(width) * DEPTH, 0),
+        mMask(roundUpPowerOfTwo(width) - 1),
+        mSamples(0)
+    {
+    }
+
+    void recordAccess(const Entry& key, size_t cachedEntries) override {
+        const uint64_t hash = Entry::Hash{}(key);
+        bool added = false;
+
+        for(size_t i = 0; i < DEPTH; i++) {
+            auto& counter = mCounters[index(hash, i)];
+
+            if(counter < MAX_COUNT) {
+                ++counter;
+                added = true;
+            }
+        }
+
+        if(added && ++mSamples >= SAMPLES_PER_ENTRY * (std::max)(cachedEntries, MIN_ENTRIES))
+            age();
+    }
+
+    bool admit(const Entry& candidate, const Entry& victim) override {
+        return frequency(candidate) > frequency(victim);
+    }
+
+    uint8_t frequency(const Entry& key) const {
+        const uint64_t hash = Entry::Hash{}(key);
+        uint8_t count = MAX_COUNT;
+
+        for(size_t i = 0; i < DEPTH; i++)
+            count = (std::min)(count, mCounters[index(hash, i)]);
+
+        return count;
+    }
+
+private:
+    static constexpr size_t DEPTH = 4;
+    static constexpr uint8_t MAX_COUNT = 15;
+    static constexpr size_t SAMPLES_PER_ENTRY = 10;
+    static constexpr size_t MIN_ENTRIES = 16;
+
+    static size_t roundUpPowerOfTwo(size_t n) {
+        size_t p = 1;
+        while(p < n)
+            p <<= 1;
+
+        return p;
+    }
+
+    size_t index(uint64_t hash, size_t row) const {
+        static constexpr uint64_t SEEDS[DEPTH] = {
+            0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL, 0x94d049bb133111ebULL, 0xd6e8feb86659fd93ULL };
+
+        uint64_t h = (hash + SEEDS[row]) * SEEDS[(row + 1) % DEPTH];
+        h ^= h >> 32;
+
+        return row * (mMask + 1) + (h & mMask);
+    }
+
+    // Halve all counters so old popularity fades
+    void age() {
+        for(auto& counter : mCounters)
+            counter >>= 1;
+
+        mSamples /= 2;
+    }
+
+private:
+    std::vector<uint8_t> mCounters;
+    const size_t mMask;
+    size_t mSamples;
+};
+
+// Byte limited cache of rendered files. New entries go to an LRU admission window first. Entries pushed
+// out of the window move to the main LRU segment if there is room, otherwise the policy decides whether
+// they replace the main segment's least recently used entry or are dropped. Without a window and with
+// LruPolicy this is a plain LRU cache.
+//
+// Entries are charged by the capacity of their buffer and belong to an owner, usually the mounted file
+// that rendered them. When the cache is full and several owners share it, an owner holding more than its
+// fair share gives up its own least recently used entries first.
 class LRUCache {
 public:
-    explicit LRUCache(size_t maxSize) : mMaxSize(maxSize), mCurrentSize(0) {}
+    explicit LRUCache(size_t maxSize) :
+        LRUCache(maxSize, std::make_unique<LruPolicy>(), 0) {}
+
+    LRUCache(size_t maxSize, std::unique_ptr<CachePolicy> policy, size_t windowSize) :
+        mPolicy(std::move(policy)),
+        mMaxSize(maxSize),
+        mWindowTargetSize(windowSize),
+        mWindowMaxSize((std::min)(windowSize, maxSize)),
+        mCurrentSize(0),
+        mWindowSize(0) {}
 
     // Get value from cache, returns nullptr if not found
     // If another thread is already processing the same key, this thread will wait
@@ -47,54 +167,62 @@ public:
             return nullptr;
         }
 
-        // Cache hit, move to front of list (most recently used)
-        mCacheList.splice(mCacheList.begin(), mCacheList, it->second);
+        // Cache hit, move to front of its segment (most recently used)
+        auto& list = segment(it->second);
+        list.splice(list.begin(), list, it->second.item);
 
-        return it->second->second;
+        return it->second.item->value;
+    }
+
+    // Count a read of the entry for the admission policy, called once per file read rather than per block
+    void recordAccess(const Entry& key) {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        mPolicy->recordAccess(key, mCacheMap.size());
     }
 
     // Add or update value in cache
-    void put(const Entry& key, std::shared_ptr<std::vector<char>> value) {
+    void put(const Entry& key, std::shared_ptr<std::vector<char>> value, const void* owner = nullptr) {
         std::lock_guard<std::mutex> lock(mMutex);
 
-        size_t valueSize = value->size();
+        // Reserved memory counts, not just the bytes in use
+        size_t valueSize = value->capacity();
 
         // Check if key already exists in cache
         auto it = mCacheMap.find(key);
 
         if (it != mCacheMap.end()) {
+            auto& item = *it->second.item;
+
             // Update value
-            size_t oldSize = it->second->second->size();
-            mCurrentSize -= oldSize;
+            mCurrentSize -= item.bytes;
             mCurrentSize += valueSize;
+            mOwnerSize[item.owner] -= item.bytes;
+            mOwnerSize[item.owner] += valueSize;
 
-            // Move to front and update
-            mCacheList.splice(mCacheList.begin(), mCacheList, it->second);
-            it->second->second = value;
-        }
-        else {
-            // New entry
-
-            // If adding this would exceed max size, remove older entries
-            while (!mCacheList.empty() && (mCurrentSize + valueSize > mMaxSize)) {
-                auto last = mCacheList.back();
-                mCurrentSize -= last.second->size();
-                mCacheMap.erase(last.first);
-                mCacheList.pop_back();
+            if(it->second.inWindow) {
+                mWindowSize -= item.bytes;
+                mWindowSize += valueSize;
             }
 
-            // If the single item is too large for the cache, don't add it
-            if (valueSize > mMaxSize) {
-                // Remove from in-progress set and notify waiting threads
-                mInProgress.erase(key);
-                mCondition.notify_all();
-                return;
-            }
+            item.value = value;
+            item.bytes = valueSize;
 
-            // Add new entry
-            mCacheList.emplace_front(key, value);
-            mCacheMap[key] = mCacheList.begin();
+            // Move to front
+            auto& list = segment(it->second);
+            list.splice(list.begin(), list, it->second.item);
+
+            evict();
+        }
+        else if (valueSize <= mMaxSize) {
+            // New entry, starts out in the admission window
+            mWindowList.push_front(CacheItem{ key, value, valueSize, owner });
+            mCacheMap[key] = Slot{ mWindowList.begin(), true };
             mCurrentSize += valueSize;
+            mWindowSize += valueSize;
+            mOwnerSize[owner] += valueSize;
+
+            evict();
         }
 
         // Remove from in-progress set and notify waiting threads
@@ -111,9 +239,12 @@ public:
         auto it = mCacheMap.find(key);
 
         if (it != mCacheMap.end()) {
-            mCurrentSize -= it->second->second->size();
-            mCacheList.erase(it->second);
-            mCacheMap.erase(it);
+            auto item = it->second.item;
+
+            if(it->second.inWindow)
+                mWindowSize -= item->bytes;
+
+            drop(segment(it->second), item);
         }
 
         // Also remove from in-progress set if present and notify
@@ -122,14 +253,40 @@ public:
         }
     }
 
+    // Remove all entries of an owner, e.g. when its file is unmounted. The owner must have stopped putting
+    // entries, anything put later is charged to an owner that no longer exists.
+    void removeOwner(const void* owner) {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        for(auto* list : { &mWindowList, &mCacheList }) {
+            for(auto item = list->begin(); item != list->end();) {
+                auto next = std::next(item);
+
+                if(item->owner == owner) {
+                    if(list == &mWindowList)
+                        mWindowSize -= item->bytes;
+
+                    drop(*list, item);
+                }
+
+                item = next;
+            }
+        }
+
+        mOwnerSize.erase(owner);
+    }
+
     // Clear the cache
     void clear() {
         std::lock_guard<std::mutex> lock(mMutex);
 
         mCacheMap.clear();
         mCacheList.clear();
+        mWindowList.clear();
         mInProgress.clear();
+        mOwnerSize.clear();
         mCurrentSize = 0;
+        mWindowSize = 0;
         mCondition.notify_all();
     }
 
@@ -140,11 +297,34 @@ public:
         return mCurrentSize;
     }
 
+    // Bytes held by entries of an owner
+    size_t size(const void* owner) const {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        auto it = mOwnerSize.find(owner);
+        return it != mOwnerSize.end() ? it->second : 0;
+    }
+
     // Get maximum size
     size_t capacity() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+
         return mMaxSize;
     }
 
+    // Change the maximum size, entries are evicted right away when the cache shrinks
+    void setCapacity(size_t maxSize) {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if(maxSize == mMaxSize)
+            return;
+
+        mMaxSize = maxSize;
+        mWindowMaxSize = (std::min)(mWindowTargetSize, maxSize);
+
+        evict();
+    }
+
     // Method to mark that processing for a key has failed
     // This should be called if the caller gets nullptr from get() but fails to load the data
     void markLoadFailed(const Entry& key) {
@@ -154,15 +334,107 @@ public:
     }
 
 private:
-    using CacheItem = std::pair<Entry, std::shared_ptr<std::vector<char>>>;
+    struct CacheItem {
+        Entry key;
+        std::shared_ptr<std::vector<char>> value;
+        size_t bytes;
+        const void* owner;
+    };
+
     using CacheList = std::list<CacheItem>;
-    using CacheMap = std::unordered_map<Entry, typename CacheList::iterator, Entry::Hash>;
 
-    CacheList mCacheList; // List of cache entries, most recently used at the front
-    CacheMap mCacheMap;   // Map from key to list iterator
+    struct Slot {
+        typename CacheList::iterator item;
+        bool inWindow;
+    };
+
+    using CacheMap = std::unordered_map<Entry, Slot, Entry::Hash>;
+
+    CacheList& segment(const Slot& slot) {
+        return slot.inWindow ? mWindowList : mCacheList;
+    }
+
+    void drop(CacheList& list, typename CacheList::iterator item) {
+        mCurrentSize -= item->bytes;
+
+        auto owner = mOwnerSize.find(item->owner);
+        owner->second -= item->bytes;
+        if(owner->second == 0)
+            mOwnerSize.erase(owner);
+
+        mCacheMap.erase(item->key);
+        list.erase(item);
+    }
+
+    // Least recently used entry of the main segment, taken from the owner furthest over its fair share
+    typename CacheList::iterator victim() {
+        auto victim = std::prev(mCacheList.end());
+
+        if(mOwnerSize.size() < 2)
+            return victim;
+
+        const size_t fairShare = mMaxSize / mOwnerSize.size();
+        const void* greediest = nullptr;
+        size_t greediestSize = fairShare;
+
+        for(const auto& [owner, ownerSize] : mOwnerSize) {
+            if(ownerSize > greediestSize) {
+                greediest = owner;
+                greediestSize = ownerSize;
+            }
+        }
+
+        if(greediestSize == fairShare)
+            return victim;
+
+        for(auto item = mCacheList.rbegin(); item != mCacheList.rend(); ++item) {
+            if(item->owner == greediest)
+                return std::prev(item.base());
+        }
+
+        return victim;
+    }
+
+    // Moves entries that overflow the window to the main segment and trims the cache to its size
+    void evict() {
+        while (!mWindowList.empty() && mWindowSize > mWindowMaxSize) {
+            auto candidate = std::prev(mWindowList.end());
+
+            mWindowSize -= candidate->bytes;
+
+            // Main segment is full, the candidate has to win against the entry it would replace
+            if (!mCacheList.empty() && mCurrentSize > mMaxSize &&
+                !mPolicy->admit(candidate->key, victim()->key))
+            {
+                drop(mWindowList, candidate);
+                continue;
+            }
+
+            mCacheList.splice(mCacheList.begin(), mWindowList, candidate);
+            mCacheMap[candidate->key].inWindow = false;
+        }
+
+        while (!mCacheList.empty() && mCurrentSize > mMaxSize)
+            drop(mCacheList, victim());
+
+        // Window holds more than the whole cache
+        while (!mWindowList.empty() && mCurrentSize > mMaxSize) {
+            mWindowSize -= mWindowList.back().bytes;
+            drop(mWindowList, std::prev(mWindowList.end()));
+        }
+    }
+
+    CacheList mCacheList;  // Main segment, most recently used at the front
+    CacheList mWindowList; // Admission window, most recently used at the front
+    CacheMap mCacheMap;    // Map from key to list iterator
     std::unordered_set<Entry, Entry::Hash> mInProgress; // Set of keys currently being processed
-    size_t mMaxSize;      // Maximum cache size in bytes
-    size_t mCurrentSize;  // Current cache size in bytes
+    std::unordered_map<const void*, size_t> mOwnerSize; // Bytes held by each owner
+    std::unique_ptr<CachePolicy> mPolicy;
+    size_t mMaxSize;       // Maximum cache size in bytes
+    size_t mWindowTargetSize; // Admission window size the cache was created with
+    size_t mWindowMaxSize; // Maximum admission window size in bytes
+    size_t mCurrentSize;   // Current cache size in bytes
+    size_t mWindowSize;    // Current admission window size in bytes
     mutable std::mutex mMutex; // Mutex for thread safety
     mutable std::condition_variable mCondition; // Condition variable for waiting
 };
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace motioncam {
+
+// Read-only memory mapping of a source file. The mapping is shared by all IO threads
+// and is used to hint the OS about byte ranges that will be read soon, so that they are
+// already in the page cache when a decoder reads them.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return mData; }
+    size_t size() const { return mSize; }
+    bool isValid() const { return mData != nullptr; }
+
+    // Asynchronously page in [offset, offset + length). Does not block.
+    void willNeed(size_t offset, size_t length) const;
+
+private:
+    const uint8_t* mData;
+    size_t mSize;
+#ifdef _WIN32
+    void* mFile;
+    void* mMapping;
+#else
+    int mFd;
+#endif
+};
+
+} // namespace motioncam
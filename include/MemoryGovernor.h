@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace motioncam {
+
+class LRUCache;
+class RenderBudget;
+
+// Keeps the memory of all mounted files within one budget. Mounted files report what they hold outside the
+// cache, the render budget is set aside for frames in flight and the cache gets what is left, up to the size
+// it was created with. The cache shrinks further while the system runs low on memory and grows back once the
+// pressure is gone. Fair shares between mounts are enforced by the cache itself.
+class MemoryGovernor {
+public:
+    using UsageCallback = std::function<size_t()>;
+
+    MemoryGovernor(LRUCache& cache, const RenderBudget& renderBudget, size_t budget);
+    ~MemoryGovernor();
+
+    MemoryGovernor(const MemoryGovernor&) = delete;
+    MemoryGovernor& operator=(const MemoryGovernor&) = delete;
+
+    // Usage is polled from the governor thread until the mount is removed
+    void addMount(const void* mount, UsageCallback usage);
+
+    // Also drops the mount's cached files, call it once the mount no longer renders
+    void removeMount(const void* mount);
+
+private:
+    void run();
+    void update();
+
+private:
+    LRUCache& mCache;
+    const RenderBudget& mRenderBudget;
+    const size_t mBudget;
+    const size_t mMaxCacheSize;
+    size_t mPressureLimit;
+    std::map<const void*, UsageCallback> mMounts;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mStop;
+    std::thread mThread;
+};
+
+} // namespace motioncam
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace motioncam {
+
+// Bounds the memory held by frames that are being decoded and rendered, across all mounted files.
+// Each frame reserves its raw and DNG size before it is loaded and gives it back once rendered.
+// Loads past the budget do not wait on an IO thread, they are retried once budget comes back, so a
+// burst of reads queues up as pending jobs instead of buffers or blocked threads.
+class RenderBudget {
+public:
+    using Retry = std::function<void()>;
+
+    explicit RenderBudget(size_t maxBytes) : mMaxBytes(maxBytes), mInFlightBytes(0), mInFlightFrames(0) {}
+
+    RenderBudget(const RenderBudget&) = delete;
+    RenderBudget& operator=(const RenderBudget&) = delete;
+
+    // Reserves the bytes if they fit. A frame is always admitted when nothing is in flight, so frames
+    // larger than the budget still render one at a time. The budget is returned when the last reference
+    // to the reservation goes away.
+    //
+    // Returns null when the bytes do not fit. retry is then called once, on the thread that returns the
+    // next reservation, and should only queue the load again.
+    std::shared_ptr<void> tryReserve(size_t bytes, Retry retry) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            if(mInFlightFrames > 0 && mInFlightBytes + bytes > mMaxBytes) {
+                mRetries.push_back(std::move(retry));
+                return nullptr;
+            }
+
+            mInFlightBytes += bytes;
+            ++mInFlightFrames;
+        }
+
+        return std::shared_ptr<void>(this, [bytes](void* budget) { static_cast<RenderBudget*>(budget)->release(bytes); });
+    }
+
+    // Bytes reserved by frames that are currently in flight
+    size_t inFlightBytes() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        return mInFlightBytes;
+    }
+
+    size_t capacity() const {
+        return mMaxBytes;
+    }
+
+private:
+    void release(size_t bytes) {
+        std::vector<Retry> retries;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            mInFlightBytes -= bytes;
+            --mInFlightFrames;
+
+            retries.swap(mRetries);
+        }
+
+        // Loads that do not fit yet register again
+        for(auto& retry : retries)
+            retry();
+    }
+
+private:
+    const size_t mMaxBytes;
+    size_t mInFlightBytes;
+    size_t mInFlightFrames;
+    std::vector<Retry> mRetries;
+    mutable std::mutex mMutex;
+};
+
+} // namespace motioncam
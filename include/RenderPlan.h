@@ -0,0 +1,160 @@
+#pragma once
+
+#include "Types.h"
+
+#include <tinydng/tiny_dng_writer.h>
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace motioncam {
+
+struct CameraConfiguration;
+
+// Codes a clip uses in a few sample frames, measured when it is mounted. Frames that were not sampled
+// can use codes outside of the range.
+struct CodeRange {
+    uint16_t maxValue = 0;
+    uint16_t usedBits = 0;      // Bits set in any sample
+    size_t maxCount = 0;        // Samples at maxValue
+
+    void add(const uint16_t* samples, size_t count);
+    void add(const CodeRange& other);
+};
+
+// Preprocess kernel variants (see utils::preprocessData). Kernels are instantiated for the combinations a plan
+// selects so the per-pixel loops have no option branches left in them.
+enum class KernelLayout {
+    Bayer,              // 2x2 blocks, sampled with the CFA pitch
+    QuadBayerBinned,    // 2x2 blocks, each sample is the sum of a quad bayer 2x2 group
+    QuadBayerRemosaic,  // 2x2 blocks of quad bayer data remosaiced to the bayer pattern of the CFA
+    QuadBayer           // 4x4 quad bayer blocks at full resolution
+};
+
+enum class KernelTransform {
+    Linear,
+    Log,
+    DebugShading,
+    LinearFixed,        // Linear and Log through integer tables, without the shading map
+    LogFixed
+};
+
+struct KernelSelection {
+    KernelLayout layout;
+    KernelTransform transform;      // Linear or Log switch to the fixed point variant for small enough white levels
+    uint32_t fixedPointMaxInput;    // Largest source white level of the fixed point variant, zero if there is none
+};
+
+// Everything needed to render frames of a file that does not change from frame to frame. Built once
+// when a file is mounted or its render options change, and shared by all render tasks of that
+// generation. The setting strings are parsed here and not per frame.
+struct RenderPlan {
+    RenderSettings settings;
+    std::shared_ptr<const CameraConfiguration> cameraConfiguration;
+
+    float recordingFps;
+    double baselineExpValue;
+
+    // Options
+    uint32_t scale;
+    bool applyShadingMap;
+    bool vignetteOnlyColor;
+    bool normalizeShadingMap;
+    bool debugShadingMap;
+    bool normalizeExposure;
+    bool interpretAsQuadBayer; // Frames flagged with needRemosaic are always treated as quad bayer
+
+    // Adaptive bit depth, linear output drops the low bits no sampled frame uses and is limited to the code
+    // the sampled frames saturate at. Lossy for frames that use codes outside of the sampled range, which is
+    // why it is off by default. Both zero when disabled or nothing can be dropped.
+    uint32_t codeShift;
+    uint32_t codeCeiling;
+
+    // Kernel for frames that are not and that are treated as quad bayer
+    std::array<KernelSelection, 2> kernels;
+
+    // Crop target, zero when cropping is disabled
+    uint32_t cropWidth;
+    uint32_t cropHeight;
+
+    // Level overrides, dynamic levels from the frame metadata are used when not set
+    std::optional<float> whiteLevel;
+    std::optional<std::array<float, 4>> blackLevel;
+
+    // DNG tags
+    std::array<uint8_t, 4> cfa;
+    std::array<uint8_t, 16> quadCfa;
+    bool quadCfaTags;          // Quad bayer frames are tagged with the 4x4 pattern
+    bool logLinearization;     // Stored log values are mapped back to linear by a linearization table
+    float exposureOffset;
+    int calibrationIlluminant1;
+    int calibrationIlluminant2;
+    std::string uniqueCameraModel;
+    std::string make;
+    std::string cameraModelName;
+
+    static std::shared_ptr<const RenderPlan> create(
+        const RenderSettings& settings,
+        std::shared_ptr<const CameraConfiguration> cameraConfiguration,
+        float recordingFps,
+        double baselineExpValue,
+        const CodeRange* codeRange = nullptr);
+
+    // Table mapping stored log values back to linear, built once per white level
+    const std::vector<unsigned short>& logLinearizationTable(unsigned short whiteLevel) const;
+
+    // Everything a frame independent payload (see utils::isFrameIndependent) is rendered from
+    struct PayloadKey {
+        uint64_t shadingMapHash;
+        int shadingMapWidth;
+        int shadingMapHeight;
+        uint32_t width;
+        uint32_t height;
+        int originalWidth;
+        int originalHeight;
+        std::array<float, 4> blackLevel;
+        float whiteLevel;
+
+        bool operator==(const PayloadKey& other) const;
+    };
+
+    // Packed pixel data rendered for an earlier frame with the same key, null if there is none
+    std::shared_ptr<const std::vector<uint8_t>> findPayload(const PayloadKey& key) const;
+    void storePayload(const PayloadKey& key, std::shared_ptr<const std::vector<uint8_t>> payload) const;
+
+    // Everything the lens shading gain map opcode is built from
+    struct OpcodeListKey {
+        uint64_t shadingMapHash;
+        int mapWidth;
+        int mapHeight;
+        uint32_t width;
+        uint32_t height;
+        int left;
+        int top;
+
+        bool operator==(const OpcodeListKey& other) const;
+    };
+
+    // Shading maps rarely change between frames, so the opcode list is built once for each map and crop
+    // geometry and shared by all frames that use it. Null if there is none for the key.
+    std::shared_ptr<const tinydngwriter::OpcodeList> findOpcodeList(const OpcodeListKey& key) const;
+    void storeOpcodeList(const OpcodeListKey& key, std::shared_ptr<const tinydngwriter::OpcodeList> opcodeList) const;
+
+private:
+    mutable std::mutex mTableMutex;
+    mutable std::map<unsigned short, std::vector<unsigned short>> mLinearizationTables;
+
+    mutable std::mutex mPayloadMutex;
+    mutable std::vector<std::pair<PayloadKey, std::shared_ptr<const std::vector<uint8_t>>>> mPayloads;
+
+    mutable std::mutex mOpcodeListMutex;
+    mutable std::vector<std::pair<OpcodeListKey, std::shared_ptr<const tinydngwriter::OpcodeList>>> mOpcodeLists;
+};
+
+} // namespace motioncam
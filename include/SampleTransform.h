@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Dither.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace motioncam {
+
+// Per sample transforms of the preprocess kernels. Without the shading map a sample only depends on its
+// value and channel, so for 10 to 12 bit sources the float transforms are evaluated once per code into
+// tables and the kernels only look them up.
+
+// Largest source sample the integer tables cover (12 bit, the sum of four when binning)
+constexpr uint32_t FIXED_POINT_MAX_INPUT = 4095;
+
+// Fractional bits of the log tables, the integer dither has the same
+constexpr int FIXED_POINT_LOG_SHIFT = DITHER_FIXED_POINT_SHIFT;
+
+// Linearized output level above the black level
+inline float linearLevel(float sample, float linear, float srcBlackLevel, float shading, float dstRange) {
+    return std::max(0.0f, linear * (sample - srcBlackLevel) * shading) * dstRange;
+}
+
+// Log encoded output level above the black level, black and white are kept as identity points
+inline float logLevel(float sample, float linear, float srcBlackLevel, float shading, float dstWhiteLevel) {
+    const float logValue = std::log2(1.0f + 60.0f * std::max(0.0f, linear * (sample - srcBlackLevel) * shading)) / std::log2(61.0f);
+
+    return logValue * dstWhiteLevel;
+}
+
+// Rounds an output level to the code that is stored
+inline uint16_t storeLevel(float level, float dstBlackLevel, float storedMaxLevel, uint32_t codeShift) {
+    return static_cast<uint16_t>(std::clamp(std::round(level + dstBlackLevel), 0.f, storedMaxLevel)) >> codeShift;
+}
+
+// Stored linear codes of the samples 0 to maxSample without the shading map
+std::vector<uint16_t> linearTable(
+    float linear, float srcBlackLevel, float dstWhiteLevel, float dstBlackLevel, float storedMaxLevel, uint32_t codeShift, uint32_t maxSample);
+
+// Log output levels of the samples 0 to maxSample without the shading map, including the black level and
+// with FIXED_POINT_LOG_SHIFT fractional bits
+std::vector<int32_t> logTable(float linear, float srcBlackLevel, float dstWhiteLevel, float dstBlackLevel, uint32_t maxSample);
+
+// Adds the integer dither to a log table value and rounds it to the stored code. Both are non-negative
+// together, so the shift rounds to nearest.
+inline uint16_t storeLogFixed(int32_t tableValue, int16_t dither, int32_t whiteLevel) {
+    return static_cast<uint16_t>(std::min(whiteLevel, (tableValue + dither + (1 << (FIXED_POINT_LOG_SHIFT - 1))) >> FIXED_POINT_LOG_SHIFT));
+}
+
+} // namespace motioncam
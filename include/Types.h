@@ -76,6 +76,7 @@ enum FileRenderOptions : unsigned int {
     RENDER_OPT_CAMMODEL_OVERRIDE            = 1 << 8,
     RENDER_OPT_LOG_TRANSFORM                = 1 << 9,
     RENDER_OPT_INTERPRET_AS_QUAD_BAYER      = 1 << 10,
+    RENDER_OPT_ADAPTIVE_BIT_DEPTH           = 1 << 11,
 };
 
 // Overload bitwise OR operator
@@ -143,6 +144,9 @@ static std::string optionsToString(FileRenderOptions options) {
     if (options & RENDER_OPT_INTERPRET_AS_QUAD_BAYER) {
         flags.push_back("INTERPRET_AS_QUAD_BAYER");
     }
+    if (options & RENDER_OPT_ADAPTIVE_BIT_DEPTH) {
+        flags.push_back("ADAPTIVE_BIT_DEPTH");
+    }
     
     std::string result;
     for (size_t i = 0; i < flags.size(); ++i) {
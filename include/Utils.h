@@ -6,14 +6,19 @@
 #include <streambuf>
 #include <ostream>
 #include <algorithm>
+#include <functional>
 #include <memory>
 
 #include "Types.h"
 
+namespace BS {
+class thread_pool;
+}
+
 namespace motioncam {
 
 struct CameraFrameMetadata;
-struct CameraConfiguration;
+struct RenderPlan;
 
 namespace utils {
 
@@ -155,16 +160,20 @@ public:
     }
 };
 
+// True when the frame renders without its pixel data, data passed to generateDng can then be empty
+bool isFrameIndependent(const RenderPlan& plan, const CameraFrameMetadata& metadata);
+
 std::shared_ptr<std::vector<char>> generateDng(
     std::vector<uint8_t>& data,
     const CameraFrameMetadata& metadata,
-    const CameraConfiguration& cameraConfiguration,
-    float recordingFps,
+    const RenderPlan& plan,
     int frameNumber,
-    double baselineExpValue,
-    const RenderSettings& settings
+    BS::thread_pool* pool = nullptr
 );
 
+// Calls fn(0..count-1) on the pool, the calling thread takes part. Runs inline without a pool.
+void parallelFor(BS::thread_pool* pool, size_t count, const std::function<void(size_t)>& fn);
+
 std::pair<int, int> toFraction(float frameRate, int base = 1000);
 
 } // namespace utils
@@ -3,6 +3,13 @@
 #include <IVirtualFileSystem.h>
 #include <IFuseFileSystem.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
 namespace BS {
 class thread_pool;
 }
@@ -11,6 +18,25 @@ namespace motioncam {
 
 class Decoder;
 class LRUCache;
+class RenderBudget;
+class MemoryGovernor;
+class MappedFile;
+class IoScheduler;
+class BufferPool;
+struct RenderPlan;
+struct CodeRange;
+
+// Frames of a file that were rendered, skipped or thrown away because their readers went away
+struct RenderStats {
+    size_t decodedFrames;
+    size_t skippedFrames;
+    size_t wastedFrames;
+
+    // Share of decoded frames nobody received
+    double wastedRatio() const {
+        return decodedFrames > 0 ? static_cast<double>(wastedFrames) / decodedFrames : 0.0;
+    }
+};
 
 class VirtualFileSystemImpl_MCRAW : public IVirtualFileSystem
 {
@@ -19,6 +45,8 @@ public:
         BS::thread_pool& ioThreadPool,
         BS::thread_pool& processingThreadPool,
         LRUCache& lruCache,
+        RenderBudget& renderBudget,
+        MemoryGovernor& memoryGovernor,
         const RenderSettings& settings,
         const std::string& file,
         const std::string& baseName);
@@ -34,10 +62,12 @@ public:
         const size_t len,
         void* dst,
         std::function<void(size_t, int)> result,
-        bool async=true) override;
+        bool async=true,
+        CancelToken cancelToken=nullptr) override;
 
     void updateOptions(const RenderSettings& settings) override;
     FileInfo getFileInfo() const;
+    RenderStats getRenderStats() const;
 
 private:
     void init(FileRenderOptions options);
@@ -48,24 +78,65 @@ private:
         const size_t len,
         void* dst,
         std::function<void(size_t, int)> result,
-        bool async);
+        bool async,
+        CancelToken cancelToken);
 
     size_t generateAudio(
         const Entry& entry,
         const size_t pos,
         const size_t len,
-        void* dst,
-        std::function<void(size_t, int)> result,
-        bool async);
+        void* dst);
+
+    void prefetchFrames(size_t frameIndex);
+    void logRenderStats() const;
+    size_t residentBytes() const;
+    void completeReads(const Entry& entry, const std::shared_ptr<std::vector<char>>& dngData);
+    bool dropAbandonedReads(const Entry& entry);
+    // Loads the frame at filePosition once its bytes fit in the render budget, load gets the reservation
+    using Load = std::function<void(std::shared_ptr<void>)>;
+    void submitLoad(size_t filePosition, size_t bytes, Load load);
+
+    std::shared_ptr<void> trackTask();
+    void waitForTasks();
+
+private:
+    struct PendingRead {
+        CancelToken cancelToken;
+        std::function<void(std::shared_ptr<std::vector<char>>)> complete;
+    };
 
 private:
     LRUCache& mCache;
+    RenderBudget& mRenderBudget;
+    MemoryGovernor& mMemoryGovernor;
     BS::thread_pool& mIoThreadPool;
     BS::thread_pool& mProcessingThreadPool;
+    std::unique_ptr<IoScheduler> mIoScheduler;
+    std::shared_ptr<BufferPool> mBufferPool;
+    std::shared_ptr<const RenderPlan> mRenderPlan;
+    std::unique_ptr<CodeRange> mCodeRange;
     const std::string mSrcPath;
     const std::string mBaseName;
     size_t mTypicalDngSize;
+    size_t mFrameRenderBytes;
+    std::atomic<size_t> mStaticBytes;
     std::vector<Entry> mFiles;
+    std::vector<int64_t> mFrames; // Set once by the first init
+    std::vector<std::pair<size_t, size_t>> mFrameRanges;
+    std::unique_ptr<MappedFile> mMappedFile;
+    size_t mReadaheadStart;
+    size_t mReadaheadEnd;
+    size_t mReadaheadWindow;
+    std::mutex mReadaheadMutex;
+    std::unordered_map<Entry, std::vector<PendingRead>, Entry::Hash> mPendingReads;
+    std::mutex mPendingReadsMutex;
+    size_t mActiveTasks;
+    std::mutex mActiveTasksMutex;
+    std::condition_variable mActiveTasksCondition;
+    std::atomic<bool> mClosing;
+    std::atomic<size_t> mDecodedFrames;
+    std::atomic<size_t> mSkippedFrames;
+    std::atomic<size_t> mWastedFrames;
     std::vector<uint8_t> mAudioFile;
     int mDraftScale;
     CFRTarget mCFRTarget;
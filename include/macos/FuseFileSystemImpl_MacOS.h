@@ -13,6 +13,8 @@ namespace motioncam {
 
 struct Session;
 class LRUCache;
+class RenderBudget;
+class MemoryGovernor;
 
 class FuseFileSystemImpl_MacOs : public IFuseFileSystem
 {
@@ -37,6 +39,8 @@ private:
     std::unique_ptr<BS::thread_pool> mIoThreadPool;
     std::unique_ptr<BS::thread_pool> mProcessingThreadPool;
     std::unique_ptr<LRUCache> mCache;
+    std::unique_ptr<RenderBudget> mRenderBudget;
+    std::unique_ptr<MemoryGovernor> mMemoryGovernor;
 };
 
 } // namespace motioncam
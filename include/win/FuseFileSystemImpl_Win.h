@@ -13,11 +13,14 @@ namespace motioncam {
 
 class VirtualizationInstance;
 class LRUCache;
+class RenderBudget;
+class MemoryGovernor;
 
 class FuseFileSystemImpl_Win : public IFuseFileSystem
 {
 public:
     FuseFileSystemImpl_Win();
+    ~FuseFileSystemImpl_Win();
 
     MountId mount(const RenderSettings& settings, const std::string& srcFile, const std::string& dstPath) override;
     void unmount(MountId mountId) override;
@@ -30,6 +33,8 @@ private:
     std::unique_ptr<BS::thread_pool> mIoThreadPool;
     std::unique_ptr<BS::thread_pool> mProcessingThreadPool;
     std::unique_ptr<LRUCache> mCache;
+    std::unique_ptr<RenderBudget> mRenderBudget;
+    std::unique_ptr<MemoryGovernor> mMemoryGovernor;
 
 };
 
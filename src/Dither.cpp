@@ -0,0 +1,153 @@
+#include "Dither.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace motioncam {
+
+std::vector<int> voidAndClusterRanks(uint32_t seed) {
+    constexpr int N = DITHER_SIZE * DITHER_SIZE;
+    constexpr float SIGMA = 1.5f;
+
+    // Gaussian energy filter with wrapped distances
+    std::vector<float> filter(N);
+    for(int y = 0; y < DITHER_SIZE; y++) {
+        for(int x = 0; x < DITHER_SIZE; x++) {
+            const int dx = std::min(x, DITHER_SIZE - x);
+            const int dy = std::min(y, DITHER_SIZE - y);
+
+            filter[y * DITHER_SIZE + x] = std::exp(-(dx*dx + dy*dy) / (2.0f * SIGMA * SIGMA));
+        }
+    }
+
+    std::vector<uint8_t> pattern(N, 0);
+    std::vector<float> energy(N, 0.0f);
+
+    // The filter is negligible beyond this distance
+    constexpr int RADIUS = 8;
+
+    auto update = [&](int index, float sign) {
+        const int px = index % DITHER_SIZE;
+        const int py = index / DITHER_SIZE;
+
+        for(int dy = -RADIUS; dy <= RADIUS; dy++) {
+            const float* f = filter.data() + (dy & DITHER_MASK) * DITHER_SIZE;
+            float* e = energy.data() + ((py + dy) & DITHER_MASK) * DITHER_SIZE;
+
+            for(int dx = -RADIUS; dx <= RADIUS; dx++)
+                e[(px + dx) & DITHER_MASK] += sign * f[dx & DITHER_MASK];
+        }
+    };
+
+    // Highest energy set cell or lowest energy empty cell
+    auto find = [&](bool tightestCluster) {
+        int best = -1;
+
+        for(int i = 0; i < N; i++) {
+            if(pattern[i] != tightestCluster)
+                continue;
+
+            if(best < 0 || (tightestCluster ? energy[i] > energy[best] : energy[i] < energy[best]))
+                best = i;
+        }
+
+        return best;
+    };
+
+    // Random initial pattern with a tenth of the cells set
+    std::mt19937 rng(seed);
+    int ones = 0;
+
+    while(ones < N / 10) {
+        const int i = static_cast<int>(rng() % N);
+
+        if(!pattern[i]) {
+            pattern[i] = 1;
+            update(i, 1.0f);
+            ones++;
+        }
+    }
+
+    // Spread it until the tightest cluster is also the largest void
+    for(;;) {
+        const int cluster = find(true);
+        pattern[cluster] = 0;
+        update(cluster, -1.0f);
+
+        const int largestVoid = find(false);
+        pattern[largestVoid] = 1;
+        update(largestVoid, 1.0f);
+
+        if(largestVoid == cluster)
+            break;
+    }
+
+    std::vector<int> ranks(N);
+
+    // Rank the initial pattern by removing clusters, then rank the remaining cells by filling voids.
+    // Filling the largest void is the same as removing the tightest cluster of empty cells since
+    // the energies of set and empty cells add up to a constant.
+    const auto initialPattern = pattern;
+    const auto initialEnergy = energy;
+
+    for(int rank = ones - 1; rank >= 0; rank--) {
+        const int cluster = find(true);
+        pattern[cluster] = 0;
+        update(cluster, -1.0f);
+        ranks[cluster] = rank;
+    }
+
+    pattern = initialPattern;
+    energy = initialEnergy;
+
+    for(int rank = ones; rank < N; rank++) {
+        const int largestVoid = find(false);
+        pattern[largestVoid] = 1;
+        update(largestVoid, 1.0f);
+        ranks[largestVoid] = rank;
+    }
+
+    return ranks;
+}
+
+const std::array<DitherTile, 4>& ditherTiles() {
+    static const std::array<DitherTile, 4> tiles = [] {
+        constexpr int N = DITHER_SIZE * DITHER_SIZE;
+        std::array<DitherTile, 4> result;
+
+        for(int c = 0; c < 4; c++) {
+            const auto ranks = voidAndClusterRanks(0x9e3779b9u * (c + 1));
+
+            for(int i = 0; i < N; i++) {
+                // Uniform rank to triangular in [-1, 1] by the inverse CDF, scaled down for subtle
+                // dithering appropriate for log encoding
+                const float u = (ranks[i] + 0.5f) / N;
+                const float t = u < 0.5f ? std::sqrt(2.0f * u) - 1.0f : 1.0f - std::sqrt(2.0f - 2.0f * u);
+
+                result[c][i] = t * 0.5f;
+            }
+        }
+
+        return result;
+    }();
+
+    return tiles;
+}
+
+const std::array<DitherTileFixed, 4>& ditherTilesFixed() {
+    static const std::array<DitherTileFixed, 4> tiles = [] {
+        const auto& floatTiles = ditherTiles();
+        std::array<DitherTileFixed, 4> result;
+
+        for(size_t c = 0; c < result.size(); c++)
+            for(size_t i = 0; i < result[c].size(); i++)
+                result[c][i] = static_cast<int16_t>(std::lround(floatTiles[c][i] * (1 << DITHER_FIXED_POINT_SHIFT)));
+
+        return result;
+    }();
+
+    return tiles;
+}
+
+} // namespace motioncam
@@ -0,0 +1,117 @@
+#include "IoScheduler.h"
+
+#include <BS_thread_pool.hpp>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace motioncam {
+
+struct IoScheduler::Queue {
+    using Key = std::pair<size_t, uint64_t>; // position, sequence
+
+    struct Waiting {
+        size_t position;
+        uint64_t dispatchedAtSubmit;
+        size_t bypassed; // Later jobs dispatched ahead of this one
+    };
+
+    explicit Queue(size_t maxBypass) :
+        maxBypass(maxBypass),
+        head(0),
+        nextSequence(0),
+        dispatched(0)
+    {
+    }
+
+    const size_t maxBypass;
+    std::mutex mutex;
+    std::map<Key, Job> byPosition;
+    std::map<uint64_t, Waiting> bySequence; // sequence -> position, bypass count
+    size_t head;
+    uint64_t nextSequence;
+    uint64_t dispatched;
+};
+
+IoScheduler::IoScheduler(BS::thread_pool& pool, size_t maxBypass) :
+    mPool(pool),
+    mQueue(std::make_shared<Queue>(maxBypass))
+{
+}
+
+IoScheduler::~IoScheduler() {
+    cancel();
+}
+
+void IoScheduler::submit(size_t position, Job job) {
+    {
+        std::lock_guard<std::mutex> lock(mQueue->mutex);
+
+        const auto sequence = mQueue->nextSequence++;
+
+        mQueue->byPosition.emplace(Queue::Key(position, sequence), std::move(job));
+        mQueue->bySequence.emplace(sequence, Queue::Waiting{ position, mQueue->dispatched, 0 });
+    }
+
+    mPool.detach_task([queue = mQueue]() { runNext(*queue); });
+}
+
+size_t IoScheduler::cancel() {
+    std::map<Queue::Key, Job> dropped;
+
+    {
+        std::lock_guard<std::mutex> lock(mQueue->mutex);
+
+        dropped.swap(mQueue->byPosition);
+        mQueue->bySequence.clear();
+    }
+
+    // Jobs are destroyed outside the lock, whatever they hold may submit or cancel again
+    return dropped.size();
+}
+
+void IoScheduler::runNext(Queue& queue) {
+    Job job;
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if(queue.byPosition.empty())
+            return;
+
+        // Starvation bound, the oldest job goes first once later jobs overtook it often enough. It has been
+        // overtaken at least as often as any other pending job.
+        auto oldest = queue.bySequence.begin();
+        auto it = queue.byPosition.find(Queue::Key(oldest->second.position, oldest->first));
+
+        if(oldest->second.bypassed < queue.maxBypass) {
+            // Next job at or after the head, wrap around to the lowest position
+            it = queue.byPosition.lower_bound(Queue::Key(queue.head, 0));
+            if(it == queue.byPosition.end())
+                it = queue.byPosition.begin();
+        }
+
+        const uint64_t sequence = it->first.second;
+        const uint64_t dispatchedAtSubmit = queue.bySequence.at(sequence).dispatchedAtSubmit;
+
+        // Overtakes older jobs that were already waiting when this one arrived, not the ones it was
+        // submitted together with
+        for(auto older = queue.bySequence.begin(); older->first != sequence; ++older) {
+            if(older->second.dispatchedAtSubmit < dispatchedAtSubmit)
+                ++older->second.bypassed;
+        }
+
+        queue.head = it->first.first;
+        queue.bySequence.erase(sequence);
+
+        job = std::move(it->second);
+        queue.byPosition.erase(it);
+
+        ++queue.dispatched;
+    }
+
+    job();
+}
+
+} // namespace motioncam
@@ -0,0 +1,179 @@
+#include "MappedFile.h"
+
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <memoryapi.h>
+
+    #include <boost/locale.hpp>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace motioncam {
+
+namespace {
+
+    size_t pageSize() {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+
+        return static_cast<size_t>(info.dwAllocationGranularity);
+#else
+        return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+    // Clamp range to the mapping and align the start down to a page boundary
+    bool alignRange(size_t fileSize, size_t& offset, size_t& length) {
+        static const size_t page = pageSize();
+
+        if(offset >= fileSize || length == 0)
+            return false;
+
+        length = (std::min)(length, fileSize - offset);
+
+        const size_t alignedOffset = (offset / page) * page;
+
+        length += offset - alignedOffset;
+        offset = alignedOffset;
+
+        return true;
+    }
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) :
+    mData(nullptr),
+    mSize(0),
+    mFile(INVALID_HANDLE_VALUE),
+    mMapping(nullptr)
+{
+    // Paths are UTF-8, the ANSI variant fails for names outside the code page
+    const std::wstring widePath = boost::locale::conv::utf_to_utf<wchar_t>(path);
+
+    HANDLE file = CreateFileW(
+        widePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if(file == INVALID_HANDLE_VALUE) {
+        spdlog::warn("MappedFile: failed to open {}", path);
+        return;
+    }
+
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mapping == nullptr) {
+        spdlog::warn("MappedFile: failed to map {}", path);
+        CloseHandle(file);
+        return;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(view == nullptr) {
+        spdlog::warn("MappedFile: failed to create view of {}", path);
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return;
+    }
+
+    mFile = file;
+    mMapping = mapping;
+    mData = static_cast<const uint8_t*>(view);
+    mSize = static_cast<size_t>(fileSize.QuadPart);
+}
+
+MappedFile::~MappedFile() {
+    if(mData)
+        UnmapViewOfFile(mData);
+    if(mMapping)
+        CloseHandle(mMapping);
+    if(mFile != INVALID_HANDLE_VALUE)
+        CloseHandle(mFile);
+}
+
+void MappedFile::willNeed(size_t offset, size_t length) const {
+    if(!mData || !alignRange(mSize, offset, length))
+        return;
+
+    WIN32_MEMORY_RANGE_ENTRY range;
+
+    range.VirtualAddress = const_cast<uint8_t*>(mData + offset);
+    range.NumberOfBytes = length;
+
+    // Issues asynchronous reads for the range without blocking
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) :
+    mData(nullptr),
+    mSize(0),
+    mFd(-1)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        spdlog::warn("MappedFile: failed to open {}", path);
+        return;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if(addr == MAP_FAILED) {
+        spdlog::warn("MappedFile: failed to map {}", path);
+        close(fd);
+        return;
+    }
+
+    mFd = fd;
+    mData = static_cast<const uint8_t*>(addr);
+    mSize = static_cast<size_t>(st.st_size);
+}
+
+MappedFile::~MappedFile() {
+    if(mData)
+        munmap(const_cast<uint8_t*>(mData), mSize);
+    if(mFd >= 0)
+        close(mFd);
+}
+
+void MappedFile::willNeed(size_t offset, size_t length) const {
+    if(!mData || !alignRange(mSize, offset, length))
+        return;
+
+    madvise(const_cast<uint8_t*>(mData + offset), length, MADV_WILLNEED);
+
+#if defined(__APPLE__)
+    // madvise() only affects the mapping on macOS, also start reading into the unified buffer cache
+    struct radvisory advisory;
+
+    advisory.ra_offset = static_cast<off_t>(offset);
+    advisory.ra_count = static_cast<int>((std::min)(length, static_cast<size_t>(INT32_MAX)));
+
+    fcntl(mFd, F_RDADVISE, &advisory);
+#elif defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(mFd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+#endif
+}
+
+#endif
+
+} // namespace motioncam
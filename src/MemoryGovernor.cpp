@@ -0,0 +1,166 @@
+#include "MemoryGovernor.h"
+#include "LRUCache.h"
+#include "RenderBudget.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+#if defined(_WIN32)
+    #include <windows.h>
+#elif defined(__APPLE__)
+    #include <mach/mach.h>
+    #include <sys/sysctl.h>
+#endif
+
+namespace motioncam {
+
+constexpr auto UPDATE_INTERVAL = std::chrono::seconds(1);
+constexpr size_t MIN_CACHE_SIZE = 64 * 1024 * 1024; // Room for a few frames being read in blocks
+constexpr size_t LOW_MEMORY_DIVISOR = 10;           // Pressure below a tenth of physical memory available
+
+namespace {
+
+    bool querySystemMemory(size_t& available, size_t& total) {
+#if defined(_WIN32)
+        MEMORYSTATUSEX status;
+        status.dwLength = sizeof(status);
+
+        if(!GlobalMemoryStatusEx(&status))
+            return false;
+
+        available = static_cast<size_t>(status.ullAvailPhys);
+        total = static_cast<size_t>(status.ullTotalPhys);
+
+        return true;
+#elif defined(__APPLE__)
+        uint64_t memSize = 0;
+        size_t length = sizeof(memSize);
+
+        if(sysctlbyname("hw.memsize", &memSize, &length, nullptr, 0) != 0)
+            return false;
+
+        vm_statistics64_data_t stats;
+        mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+
+        if(host_statistics64(mach_host_self(), HOST_VM_INFO64, reinterpret_cast<host_info64_t>(&stats), &count) != KERN_SUCCESS)
+            return false;
+
+        // Inactive and purgeable pages are reclaimed without swapping
+        available = static_cast<size_t>(stats.free_count + stats.inactive_count + stats.purgeable_count) * vm_kernel_page_size;
+        total = static_cast<size_t>(memSize);
+
+        return true;
+#else
+        std::ifstream meminfo("/proc/meminfo");
+        std::string key;
+        size_t value;
+        std::string unit;
+
+        available = 0;
+        total = 0;
+
+        while(meminfo >> key >> value >> unit) {
+            if(key == "MemTotal:")
+                total = value * 1024;
+            else if(key == "MemAvailable:")
+                available = value * 1024;
+        }
+
+        return total > 0;
+#endif
+    }
+}
+
+MemoryGovernor::MemoryGovernor(LRUCache& cache, const RenderBudget& renderBudget, size_t budget) :
+    mCache(cache),
+    mRenderBudget(renderBudget),
+    mBudget(budget),
+    mMaxCacheSize(cache.capacity()),
+    mPressureLimit(cache.capacity()),
+    mStop(false)
+{
+    mThread = std::thread(&MemoryGovernor::run, this);
+}
+
+MemoryGovernor::~MemoryGovernor() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+
+    mCondition.notify_all();
+
+    if(mThread.joinable())
+        mThread.join();
+}
+
+void MemoryGovernor::addMount(const void* mount, UsageCallback usage) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mMounts[mount] = std::move(usage);
+
+    update();
+}
+
+void MemoryGovernor::removeMount(const void* mount) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mMounts.erase(mount);
+    mCache.removeOwner(mount);
+
+    update();
+}
+
+void MemoryGovernor::run() {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while(!mStop) {
+        update();
+
+        mCondition.wait_for(lock, UPDATE_INTERVAL, [this] { return mStop; });
+    }
+}
+
+// Called with the lock held, so mounts cannot go away while their usage is read
+void MemoryGovernor::update() {
+    size_t used = mRenderBudget.capacity();
+
+    for(const auto& [mount, usage] : mMounts)
+        used += usage();
+
+    size_t limit = mBudget > used ? (std::min)(mMaxCacheSize, mBudget - used) : 0;
+
+    size_t available, total;
+
+    if(querySystemMemory(available, total)) {
+        const size_t reserve = total / LOW_MEMORY_DIVISOR;
+
+        if(available < reserve) {
+            // Give back what the system is missing
+            const size_t deficit = reserve - available;
+            const size_t cached = mCache.size();
+
+            mPressureLimit = (std::min)(mPressureLimit, cached > deficit ? cached - deficit : 0);
+        }
+        else if(available > 2 * reserve) {
+            mPressureLimit = mMaxCacheSize;
+        }
+
+        // In between the limit is held so the cache does not grow straight back into the pressure
+        limit = (std::min)(limit, mPressureLimit);
+    }
+
+    limit = (std::max)(limit, MIN_CACHE_SIZE);
+
+    if(limit != mCache.capacity()) {
+        spdlog::info("Cache limit is now {} bytes (mounts and renders use {} bytes)", limit, used);
+
+        mCache.setCapacity(limit);
+    }
+}
+
+} // namespace motioncam
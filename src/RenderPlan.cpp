@@ -0,0 +1,426 @@
+#include "RenderPlan.h"
+#include "CameraMetadata.h"
+#include "SampleTransform.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace motioncam {
+
+constexpr size_t MAX_CACHED_PAYLOADS = 4;
+constexpr size_t MAX_CACHED_OPCODE_LISTS = 8;
+
+// Dropping more bits than this is not expected from real sensor data
+constexpr uint32_t MAX_CODE_SHIFT = 8;
+
+// Saturation clips whole areas, a maximum reached by fewer samples is not trusted as the ceiling
+constexpr size_t MIN_SATURATED_SAMPLES = 64;
+
+namespace {
+    KernelLayout selectLayout(bool interpretAsQuadBayer, uint32_t scale, QuadBayerMode quadBayerMode) {
+        if (!interpretAsQuadBayer || scale > 2)
+            return KernelLayout::Bayer;
+        else if (scale == 2)
+            return KernelLayout::QuadBayerBinned;
+        else if (quadBayerMode == QuadBayerMode::Remosaic)
+            return KernelLayout::QuadBayerRemosaic;
+
+        return KernelLayout::QuadBayer;
+    }
+
+    enum DngIlluminant {
+        lsUnknown					=  0,
+        lsDaylight					=  1,
+        lsFluorescent				=  2,
+        lsTungsten					=  3,
+        lsFlash						=  4,
+        lsFineWeather				=  9,
+        lsCloudyWeather				= 10,
+        lsShade						= 11,
+        lsDaylightFluorescent		= 12,		// D  5700 - 7100K
+        lsDayWhiteFluorescent		= 13,		// N  4600 - 5500K
+        lsCoolWhiteFluorescent		= 14,		// W  3800 - 4500K
+        lsWhiteFluorescent			= 15,		// WW 3250 - 3800K
+        lsWarmWhiteFluorescent		= 16,		// L  2600 - 3250K
+        lsStandardLightA			= 17,
+        lsStandardLightB			= 18,
+        lsStandardLightC			= 19,
+        lsD55						= 20,
+        lsD65						= 21,
+        lsD75						= 22,
+        lsD50						= 23,
+        lsISOStudioTungsten			= 24,
+
+        lsOther						= 255
+    };
+
+    int getColorIlluminant(const std::string& value) {
+        if(value == "standarda")
+            return lsStandardLightA;
+        else if(value == "standardb")
+            return lsStandardLightB;
+        else if(value == "standardc")
+            return lsStandardLightC;
+        else if(value == "d50")
+            return lsD50;
+        else if(value == "d55")
+            return lsD55;
+        else if(value == "d65")
+            return lsD65;
+        else if(value == "d75")
+            return lsD75;
+        else
+            return lsUnknown;
+    }
+
+    std::array<uint8_t, 4> getCfa(const std::string& sensorArrangement) {
+        if(sensorArrangement == "rggb")
+            return { 0, 1, 1, 2 };
+        else if(sensorArrangement == "bggr")
+            return { 2, 1, 1, 0 };
+        else if(sensorArrangement == "grbg")
+            return { 1, 0, 2, 1 };
+        else if(sensorArrangement == "gbrg")
+            return { 1, 2, 0, 1 };
+
+        throw std::runtime_error("Invalid sensor arrangement");
+    }
+
+    std::array<uint8_t, 16> getQuadCfa(const std::array<uint8_t, 4>& cfa) {
+        if (cfa == std::array<uint8_t, 4>{0,1,1,2})
+            return {0,0,1,1,0,0,1,1,1,1,2,2,1,1,2,2};
+        else if (cfa == std::array<uint8_t, 4>{2,1,1,0})
+            return {2,2,1,1,2,2,1,1,1,1,0,0,1,1,0,0};
+        else if (cfa == std::array<uint8_t, 4>{1,0,2,1})
+            return {1,1,0,0,1,1,0,0,2,2,1,1,2,2,1,1};
+
+        return {1,1,2,2,1,1,2,2,0,0,1,1,0,0,1,1};
+    }
+
+    // Parses "WxH", leaves the crop disabled when invalid
+    void parseCropTarget(const std::string& cropTarget, uint32_t& cropWidth, uint32_t& cropHeight) {
+        cropWidth = 0;
+        cropHeight = 0;
+
+        const size_t separatorPos = cropTarget.find('x');
+        if (separatorPos == std::string::npos)
+            return;
+
+        try {
+            cropWidth = std::stoul(cropTarget.substr(0, separatorPos));
+            cropHeight = std::stoul(cropTarget.substr(separatorPos + 1));
+        } catch (const std::exception&) {
+            // Ignore invalid crop target
+            cropWidth = 0;
+            cropHeight = 0;
+        }
+    }
+
+    // Parses "W/B" or "W/B,B,B,B", values can be integers or floats
+    void parseLevels(const std::string& levels, std::optional<float>& whiteLevel, std::optional<std::array<float, 4>>& blackLevel) {
+        const size_t separatorPos = levels.find('/');
+        if (separatorPos == std::string::npos)
+            return;
+
+        try {
+            const std::string whiteLevelStr = levels.substr(0, separatorPos);
+            const std::string blackLevelStr = levels.substr(separatorPos + 1);
+
+            // Parse white level (int or float)
+            if (whiteLevelStr.find('.') != std::string::npos)
+                whiteLevel = std::stof(whiteLevelStr);
+            else
+                whiteLevel = static_cast<float>(std::stoul(whiteLevelStr));
+
+            // Parse black level (single value or comma-separated values)
+            if (blackLevelStr.find(',') != std::string::npos) {
+                std::array<float, 4> blackValues = {0.0f, 0.0f, 0.0f, 0.0f};
+                size_t start = 0;
+                size_t valueIndex = 0;
+
+                while (start < blackLevelStr.length() && valueIndex < 4) {
+                    size_t commaPos = blackLevelStr.find(',', start);
+                    if (commaPos == std::string::npos) commaPos = blackLevelStr.length();
+
+                    std::string valueStr = blackLevelStr.substr(start, commaPos - start);
+                    if (valueStr.find('.') != std::string::npos) {
+                        blackValues[valueIndex] = std::stof(valueStr);
+                    } else {
+                        blackValues[valueIndex] = std::stoul(valueStr);
+                    }
+
+                    valueIndex++;
+                    start = commaPos + 1;
+                }
+                blackLevel = blackValues;
+            } else {
+                // Single value for all channels
+                float blackLevelValue;
+                if (blackLevelStr.find('.') != std::string::npos)
+                    blackLevelValue = std::stof(blackLevelStr);
+                else
+                    blackLevelValue = std::stoul(blackLevelStr);
+                blackLevel = std::array<float, 4>{blackLevelValue, blackLevelValue, blackLevelValue, blackLevelValue};
+            }
+        } catch (const std::exception&) {
+            // Keep whatever was parsed
+        }
+    }
+}
+
+std::shared_ptr<const RenderPlan> RenderPlan::create(
+    const RenderSettings& settings,
+    std::shared_ptr<const CameraConfiguration> cameraConfiguration,
+    float recordingFps,
+    double baselineExpValue,
+    const CodeRange* codeRange)
+{
+    auto plan = std::make_shared<RenderPlan>();
+    const auto& config = *cameraConfiguration;
+
+    plan->settings = settings;
+    plan->cameraConfiguration = cameraConfiguration;
+    plan->recordingFps = recordingFps;
+    plan->baselineExpValue = baselineExpValue;
+
+    const int draftScale = settings.draftScale;
+    plan->scale = (draftScale > 1 ? (draftScale / 2) * 2 : 1); // Ensure even scale for downscaling
+
+    plan->applyShadingMap = settings.options & RENDER_OPT_APPLY_VIGNETTE_CORRECTION;
+    plan->vignetteOnlyColor = settings.options & RENDER_OPT_VIGNETTE_ONLY_COLOR;
+    plan->normalizeShadingMap = settings.options & RENDER_OPT_NORMALIZE_SHADING_MAP;
+    plan->debugShadingMap = settings.options & RENDER_OPT_DEBUG_SHADING_MAP;
+    plan->normalizeExposure = settings.options & RENDER_OPT_NORMALIZE_EXPOSURE;
+    plan->interpretAsQuadBayer = settings.options & RENDER_OPT_INTERPRET_AS_QUAD_BAYER;
+
+    plan->codeShift = 0;
+    plan->codeCeiling = 0;
+
+    if((settings.options & RENDER_OPT_ADAPTIVE_BIT_DEPTH) && codeRange && codeRange->usedBits != 0) {
+        // Low bits that are zero in every sample, e.g. 10 bit data carried with a 14 bit white level
+        while(plan->codeShift < MAX_CODE_SHIFT && !(codeRange->usedBits & (1u << plan->codeShift)))
+            plan->codeShift++;
+
+        // A maximum of all ones above the shift is where the sensor saturates. Anything else could be a dark
+        // scene and later frames may go higher, so the range is only limited in that case.
+        const uint32_t ceiling = codeRange->maxValue + (1u << plan->codeShift);
+
+        if((ceiling & (ceiling - 1)) == 0 && codeRange->maxCount >= MIN_SATURATED_SAMPLES)
+            plan->codeCeiling = codeRange->maxValue;
+    }
+
+    for(bool quadBayer : { false, true }) {
+        auto& kernel = plan->kernels[quadBayer];
+
+        kernel.layout = selectLayout(quadBayer, plan->scale, settings.quadBayerOption);
+
+        if(plan->debugShadingMap && kernel.layout != KernelLayout::QuadBayer)
+            kernel.transform = KernelTransform::DebugShading;
+        else if(settings.logTransform == LogTransformMode::Disabled)
+            kernel.transform = KernelTransform::Linear;
+        else
+            kernel.transform = KernelTransform::Log;
+
+        // Without the shading map every output sample only depends on the source sample and its channel. For
+        // 10 to 12 bit sources linearization, scaling, log encoding and rounding then become a table lookup.
+        kernel.fixedPointMaxInput = 0;
+
+        if(!plan->applyShadingMap && kernel.layout != KernelLayout::QuadBayer && kernel.transform != KernelTransform::DebugShading)
+            kernel.fixedPointMaxInput = FIXED_POINT_MAX_INPUT * (kernel.layout == KernelLayout::QuadBayerBinned ? 4 : 1);
+    }
+
+    plan->cropWidth = 0;
+    plan->cropHeight = 0;
+
+    if(settings.options & RENDER_OPT_CROPPING)
+        parseCropTarget(settings.cropTarget, plan->cropWidth, plan->cropHeight);
+
+    if (settings.levels == "Static") {
+        plan->whiteLevel = config.whiteLevel;
+        plan->blackLevel = config.blackLevel;
+    } else if (!settings.levels.empty()) {
+        parseLevels(settings.levels, plan->whiteLevel, plan->blackLevel);
+    }
+
+    plan->cfa = getCfa(config.sensorArrangement);
+    plan->quadCfa = getQuadCfa(plan->cfa);
+
+    //de/remosaic need to be disabled and add ui option.
+    plan->quadCfaTags = settings.draftScale == 1 && settings.quadBayerOption == QuadBayerMode::CorrectQBCFAMetadata;
+    plan->logLinearization = settings.logTransform != LogTransformMode::Disabled &&
+                             !(settings.logTransform == LogTransformMode::KeepInput && !plan->applyShadingMap);
+
+    plan->exposureOffset = (settings.cameraModel == "Panasonic" ? -2.0f : 0.0f);
+
+    // Parse float from exposureCompensation string and add to exposureOffset
+    if (!settings.exposureCompensation.empty()) {
+        try {
+            plan->exposureOffset += std::stof(settings.exposureCompensation);
+        } catch (const std::exception&) {
+            // If parsing fails, keep the original exposureOffset value
+        }
+    }
+
+    plan->calibrationIlluminant1 = getColorIlluminant(config.colorIlluminant1);
+    plan->calibrationIlluminant2 = getColorIlluminant(config.colorIlluminant2);
+
+    if(settings.cameraModel != "") {
+        if (settings.cameraModel == "Blackmagic") {
+            plan->uniqueCameraModel = "Blackmagic Pocket Cinema Camera 4K";
+        } else if (settings.cameraModel == "Panasonic") {
+            plan->uniqueCameraModel = "Panasonic Varicam RAW";
+        } else if (settings.cameraModel == "Fujifilm" || settings.cameraModel == "Fujifilm X-T5") {
+            plan->uniqueCameraModel = "Fujifilm X-T5";
+            plan->make = "Fujifilm";
+            plan->cameraModelName = "X-T5";
+        } else {
+            // Generic camera model
+            plan->uniqueCameraModel = settings.cameraModel;
+        }
+    } else {
+        plan->uniqueCameraModel = config.extraData.postProcessSettings.metadata.buildModel;
+    }
+
+    return plan;
+}
+
+const std::vector<unsigned short>& RenderPlan::logLinearizationTable(unsigned short whiteLevel) const {
+    std::lock_guard<std::mutex> lock(mTableMutex);
+
+    auto it = mLinearizationTables.find(whiteLevel);
+    if(it != mLinearizationTables.end())
+        return it->second;
+
+    // Create linearization table sized for the actual stored range
+    // The stored values range from 0 to whiteLevel, so we need whiteLevel+1 entries
+    const int tableSize = static_cast<int>(whiteLevel) + 1;
+    std::vector<unsigned short> linearizationTable(tableSize);
+
+    for (int i = 0; i < tableSize; i++) {
+        // Convert stored log value back to linear
+        // Must match the aggressive log curve: logValue = log2(1 + k*clampedValue) / log2(1 + k)
+        // Inverse: clampedValue = (2^(logValue * log2(1 + k)) - 1) / k
+
+        float logValue = static_cast<float>(i);
+        float normalizedLogValue = logValue / whiteLevel;  // Normalize by whiteLevel to match forward transform
+
+        float linearValue;
+
+        if (i == 0) {
+            linearValue = 0.0f;  // Exact identity: stored 0 → linear 0
+        } else if (i == tableSize - 1) {
+            linearValue = 1.0f;  // Force maximum table entry → linear 1 → 65535
+        } else {
+            // Inverse of: logValue = log2(1 + k*clampedValue) / log2(1 + k)
+            linearValue = (std::pow(2.0f, normalizedLogValue * std::log2(1.0f + 60.0f)) - 1.0f) / 60.0f;
+            linearValue = std::clamp(linearValue, 0.0f, 1.0f);
+        }
+        // Scale to 16-bit range
+        linearizationTable[i] = static_cast<unsigned short>(linearValue * 65535.0f);
+    }
+
+    return mLinearizationTables.emplace(whiteLevel, std::move(linearizationTable)).first->second;
+}
+
+void CodeRange::add(const uint16_t* samples, size_t count) {
+    uint16_t maxSample = 0;
+    uint16_t bits = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        maxSample = std::max(maxSample, samples[i]);
+        bits |= samples[i];
+    }
+
+    size_t atMax = 0;
+
+    for(size_t i = 0; i < count; i++)
+        atMax += (samples[i] == maxSample);
+
+    add(CodeRange{ maxSample, bits, atMax });
+}
+
+void CodeRange::add(const CodeRange& other) {
+    if(other.maxValue > maxValue) {
+        maxValue = other.maxValue;
+        maxCount = other.maxCount;
+    }
+    else if(other.maxValue == maxValue) {
+        maxCount += other.maxCount;
+    }
+
+    usedBits |= other.usedBits;
+}
+
+bool RenderPlan::PayloadKey::operator==(const PayloadKey& other) const {
+    return shadingMapHash == other.shadingMapHash &&
+           shadingMapWidth == other.shadingMapWidth &&
+           shadingMapHeight == other.shadingMapHeight &&
+           width == other.width &&
+           height == other.height &&
+           originalWidth == other.originalWidth &&
+           originalHeight == other.originalHeight &&
+           blackLevel == other.blackLevel &&
+           whiteLevel == other.whiteLevel;
+}
+
+std::shared_ptr<const std::vector<uint8_t>> RenderPlan::findPayload(const PayloadKey& key) const {
+    std::lock_guard<std::mutex> lock(mPayloadMutex);
+
+    auto it = std::find_if(mPayloads.begin(), mPayloads.end(), [&key](const auto& entry) { return entry.first == key; });
+    if(it == mPayloads.end())
+        return nullptr;
+
+    // Keep the most recently used payload at the back
+    std::rotate(it, it + 1, mPayloads.end());
+
+    return mPayloads.back().second;
+}
+
+void RenderPlan::storePayload(const PayloadKey& key, std::shared_ptr<const std::vector<uint8_t>> payload) const {
+    std::lock_guard<std::mutex> lock(mPayloadMutex);
+
+    auto it = std::find_if(mPayloads.begin(), mPayloads.end(), [&key](const auto& entry) { return entry.first == key; });
+    if(it != mPayloads.end())
+        return;
+
+    if(mPayloads.size() >= MAX_CACHED_PAYLOADS)
+        mPayloads.erase(mPayloads.begin());
+
+    mPayloads.emplace_back(key, std::move(payload));
+}
+
+bool RenderPlan::OpcodeListKey::operator==(const OpcodeListKey& other) const {
+    return shadingMapHash == other.shadingMapHash &&
+           mapWidth == other.mapWidth && mapHeight == other.mapHeight &&
+           width == other.width && height == other.height &&
+           left == other.left && top == other.top;
+}
+
+std::shared_ptr<const tinydngwriter::OpcodeList> RenderPlan::findOpcodeList(const OpcodeListKey& key) const {
+    std::lock_guard<std::mutex> lock(mOpcodeListMutex);
+
+    auto it = std::find_if(mOpcodeLists.begin(), mOpcodeLists.end(), [&key](const auto& entry) { return entry.first == key; });
+    if(it == mOpcodeLists.end())
+        return nullptr;
+
+    // Keep the most recently used opcode list at the back
+    std::rotate(it, it + 1, mOpcodeLists.end());
+
+    return mOpcodeLists.back().second;
+}
+
+void RenderPlan::storeOpcodeList(const OpcodeListKey& key, std::shared_ptr<const tinydngwriter::OpcodeList> opcodeList) const {
+    std::lock_guard<std::mutex> lock(mOpcodeListMutex);
+
+    auto it = std::find_if(mOpcodeLists.begin(), mOpcodeLists.end(), [&key](const auto& entry) { return entry.first == key; });
+    if(it != mOpcodeLists.end())
+        return;
+
+    if(mOpcodeLists.size() >= MAX_CACHED_OPCODE_LISTS)
+        mOpcodeLists.erase(mOpcodeLists.begin());
+
+    mOpcodeLists.emplace_back(key, std::move(opcodeList));
+}
+
+} // namespace motioncam
@@ -0,0 +1,25 @@
+#include "SampleTransform.h"
+
+namespace motioncam {
+
+std::vector<uint16_t> linearTable(
+    float linear, float srcBlackLevel, float dstWhiteLevel, float dstBlackLevel, float storedMaxLevel, uint32_t codeShift, uint32_t maxSample)
+{
+    std::vector<uint16_t> table(maxSample + 1);
+
+    for (uint32_t v = 0; v <= maxSample; v++)
+        table[v] = storeLevel(linearLevel(v, linear, srcBlackLevel, 1.0f, dstWhiteLevel - dstBlackLevel), dstBlackLevel, storedMaxLevel, codeShift);
+
+    return table;
+}
+
+std::vector<int32_t> logTable(float linear, float srcBlackLevel, float dstWhiteLevel, float dstBlackLevel, uint32_t maxSample) {
+    std::vector<int32_t> table(maxSample + 1);
+
+    for (uint32_t v = 0; v <= maxSample; v++)
+        table[v] = static_cast<int32_t>(std::lround((logLevel(v, linear, srcBlackLevel, 1.0f, dstWhiteLevel) + dstBlackLevel) * (1 << FIXED_POINT_LOG_SHIFT)));
+
+    return table;
+}
+
+} // namespace motioncam
@@ -3,9 +3,20 @@
 
 #include "CameraFrameMetadata.h"
 #include "CameraMetadata.h"
+#include "RenderPlan.h"
+#include "Dither.h"
+#include "SampleTransform.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <type_traits>
 
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/device/back_inserter.hpp>
@@ -13,6 +24,7 @@
 #define TINY_DNG_WRITER_IMPLEMENTATION 1
 
 #include <tinydng/tiny_dng_writer.h>
+#include <BS_thread_pool.hpp>
 
 namespace motioncam {
 namespace utils {
@@ -31,32 +43,6 @@ namespace {
         return true;
     }
 
-    enum DngIlluminant {
-        lsUnknown					=  0,
-        lsDaylight					=  1,
-        lsFluorescent				=  2,
-        lsTungsten					=  3,
-        lsFlash						=  4,
-        lsFineWeather				=  9,
-        lsCloudyWeather				= 10,
-        lsShade						= 11,
-        lsDaylightFluorescent		= 12,		// D  5700 - 7100K
-        lsDayWhiteFluorescent		= 13,		// N  4600 - 5500K
-        lsCoolWhiteFluorescent		= 14,		// W  3800 - 4500K
-        lsWhiteFluorescent			= 15,		// WW 3250 - 3800K
-        lsWarmWhiteFluorescent		= 16,		// L  2600 - 3250K
-        lsStandardLightA			= 17,
-        lsStandardLightB			= 18,
-        lsStandardLightC			= 19,
-        lsD55						= 20,
-        lsD65						= 21,
-        lsD75						= 22,
-        lsD50						= 23,
-        lsISOStudioTungsten			= 24,
-
-        lsOther						= 255
-    };
-
     enum DngOrientation
     {
         kNormal		 = 1,
@@ -89,25 +75,6 @@ namespace {
         return bits;
     }
 
-    int getColorIlluminant(const std::string& value) {
-        if(value == "standarda")
-            return lsStandardLightA;
-        else if(value == "standardb")
-            return lsStandardLightB;
-        else if(value == "standardc")
-            return lsStandardLightC;
-        else if(value == "d50")
-            return lsD50;
-        else if(value == "d55")
-            return lsD55;
-        else if(value == "d65")
-            return lsD65;
-        else if(value == "d75")
-            return lsD75;
-        else
-            return lsUnknown;
-    }
-
     void normalizeShadingMap(std::vector<std::vector<float>>& shadingMap) {
         if (shadingMap.empty() || shadingMap[0].empty()) {
             return; // Handle empty case
@@ -240,237 +207,275 @@ namespace {
     }
 }
 
-void encodeTo10Bit(
-    std::vector<uint8_t>& data,
-    uint32_t& width,
-    uint32_t& height)
-{
-    Measure m("encodeTo10Bit");
-
-    uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
-    uint8_t* dstPtr = data.data();
-
-    for(int y = 0; y < height; y++) {
-        for(int x = 0; x < width; x+=4) {
-            const uint16_t p0 = srcPtr[0];
-            const uint16_t p1 = srcPtr[1];
-            const uint16_t p2 = srcPtr[2];
-            const uint16_t p3 = srcPtr[3];
-
-            dstPtr[0] = p0 >> 2;
-            dstPtr[1] = ((p0 & 0x03) << 6) | (p1 >> 4);
-            dstPtr[2] = ((p1 & 0x0F) << 4) | (p2 >> 6);
-            dstPtr[3] = ((p2 & 0x3F) << 2) | (p3 >> 8);
-            dstPtr[4] = p3 & 0xFF;
-
-            srcPtr += 4;
-            dstPtr += 5;
+namespace {
+    // Writes a row of samples as an MSB first bitstream, the DNG layout for BitsPerSample below 16.
+    // Rows always hold a whole number of bytes.
+    template<int Bits>
+    class PackedRowWriter {
+    public:
+        void reset(uint8_t* dst) {
+            mDst = dst;
+            mAcc = 0;
+            mCount = 0;
         }
-    }
 
-    // Resize to fit new data
-    auto newSize = dstPtr - data.data();
+        inline void put(uint32_t value) {
+            mAcc = (mAcc << Bits) | (value & ((1u << Bits) - 1));
+            mCount += Bits;
 
-    data.resize(newSize);
-}
+            while(mCount >= 8) {
+                mCount -= 8;
+                *mDst++ = static_cast<uint8_t>(mAcc >> mCount);
+            }
+        }
 
-void encodeTo12Bit(
-    std::vector<uint8_t>& data,
-    uint32_t& width,
-    uint32_t& height)
-{
-    Measure m("encodeTo12Bit");
+    private:
+        uint8_t* mDst;
+        uint32_t mAcc;
+        int mCount;
+    };
 
-    uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
-    uint8_t* dstPtr = data.data();
+    // 16 bit samples are stored as little endian words
+    template<>
+    class PackedRowWriter<16> {
+    public:
+        void reset(uint8_t* dst) {
+            mDst = dst;
+        }
 
-    for(int y = 0; y < height; y++) {
-        for(int x = 0; x < width; x+=2) {
-            const uint16_t p0 = srcPtr[0];
-            const uint16_t p1 = srcPtr[1];
+        inline void put(uint32_t value) {
+            mDst[0] = static_cast<uint8_t>(value);
+            mDst[1] = static_cast<uint8_t>(value >> 8);
+            mDst += 2;
+        }
 
-            dstPtr[0] = p0 >> 4;
-            dstPtr[1] = ((p0 & 0x0F) << 4) | (p1 >> 8);
-            dstPtr[2] = p1 & 0xFF;
+    private:
+        uint8_t* mDst;
+    };
 
-            srcPtr += 2;
-            dstPtr += 3;
-        }
+    // Reverses the byte order, all supported targets are little endian
+    inline uint64_t byteSwap64(uint64_t value) {
+#ifdef _MSC_VER
+        return _byteswap_uint64(value);
+#else
+        return __builtin_bswap64(value);
+#endif
     }
-    // Resize to fit new data
-    auto newSize = dstPtr - data.data();
 
-    data.resize(newSize);
-}
+    // Packs a whole row in the PackedRowWriter layout, four samples make Bits / 2 bytes. The width
+    // must be a multiple of 4.
+    template<int Bits>
+    void packRow(const uint16_t* src, uint8_t* dst, size_t width) {
+        if constexpr (Bits == 16) {
+            for (size_t x = 0; x < width; x++) {
+                dst[2*x] = static_cast<uint8_t>(src[x]);
+                dst[2*x + 1] = static_cast<uint8_t>(src[x] >> 8);
+            }
+        } else {
+            constexpr uint64_t mask = (1u << Bits) - 1;
 
-void encodeTo14Bit(
-    std::vector<uint8_t>& data,
-    uint32_t& width,
-    uint32_t& height)
-{
-    Measure m("encodeTo14Bit");
-
-    uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
-    uint8_t* dstPtr = data.data();
-
-    for(int y = 0; y < height; y++) {
-        for(int x = 0; x < width; x+=4) {
-            const uint16_t p0 = srcPtr[0];
-            const uint16_t p1 = srcPtr[1];
-            const uint16_t p2 = srcPtr[2];
-            const uint16_t p3 = srcPtr[3];
-
-            dstPtr[0] = p0 >> 6;
-            dstPtr[1] = ((p0 & 0x3F) << 2) | (p1 >> 12);
-            dstPtr[2] = (p1 >> 4) & 0xFF;
-            dstPtr[3] = ((p1 & 0x0F) << 4) | (p2 >> 10);
-            dstPtr[4] = (p2 >> 2) & 0xFF;
-            dstPtr[5] = ((p2 & 0x03) << 6) | (p3 >> 8);
-            dstPtr[6] = p3 & 0xFF;
-
-            srcPtr += 4;
-            dstPtr += 7;
+            for (size_t x = 0; x < width; x += 4) {
+                const uint64_t group =
+                    ((src[x] & mask) << (3 * Bits)) | ((src[x + 1] & mask) << (2 * Bits)) | ((src[x + 2] & mask) << Bits) | (src[x + 3] & mask);
+
+                // Bytes are written most significant first
+                const uint64_t bytes = byteSwap64(group << (64 - 4 * Bits));
+                std::memcpy(dst, &bytes, Bits / 2);
+
+                dst += Bits / 2;
+            }
         }
     }
 
-    // Resize to fit new data
-    auto newSize = dstPtr - data.data();
+    // Calls fn with value as a compile time constant, value must be one of Values
+    template<typename T, T... Values, typename Fn>
+    void withConstant(T value, Fn&& fn) {
+        ((value == Values ? (fn(std::integral_constant<T, Values>()), true) : false) || ...);
+    }
 
-    data.resize(newSize);
-}
+    // Kernels are only instantiated for the combinations a render plan selects. The debug output does not read the
+    // frame, so every 2x2 layout renders it with the Bayer kernel. The fixed point tables leave out the shading map.
+    constexpr bool hasKernel(bool shading, KernelLayout layout, KernelTransform transform) {
+        switch (transform) {
+            case KernelTransform::DebugShading:
+                return layout == KernelLayout::Bayer;
 
-void encodeTo8Bit(
-    std::vector<uint8_t>& data,
-    uint32_t& width,
-    uint32_t& height)
-{
-    Measure m("encodeTo8Bit");
+            case KernelTransform::LinearFixed:
+            case KernelTransform::LogFixed:
+                return !shading && layout != KernelLayout::QuadBayer;
 
-    uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
-    uint8_t* dstPtr = data.data();
+            default:
+                return true;
+        }
+    }
 
-    for(int y = 0; y < height; y++) {
-        for(int x = 0; x < width; x++) {
-            const uint16_t p0 = srcPtr[0];
-            // Store lower 8 bits directly
-            dstPtr[0] = p0 & 0xFF;
+    // Smallest supported container bit depth that holds the white level
+    unsigned short packedBits(unsigned short whiteLevel) {
+        const auto bits = bitsNeeded(whiteLevel);
+
+        if(bits <= 2)
+            return 2;
+        else if(bits <= 4)
+            return 4;
+        else if(bits <= 6)
+            return 6;
+        else if(bits <= 8)
+            return 8;
+        else if(bits <= 10)
+            return 10;
+        else if(bits <= 12)
+            return 12;
+        else if(bits <= 14)
+            return 14;
+
+        return 16;
+    }
 
-            srcPtr += 1;
-            dstPtr += 1;
-        }
+    // Sums the 2x2 groups of a quad bayer row pair into one binned row. Kept as a plain loop over whole
+    // rows so it vectorizes.
+    void binRowPair(const uint16_t* row0, const uint16_t* row1, uint16_t* dst, size_t width) {
+        for (size_t x = 0; x < width; x++)
+            dst[x] = static_cast<uint16_t>(row0[2*x] + row0[2*x + 1] + row1[2*x] + row1[2*x + 1]);
     }
 
-    // Resize to fit new data
-    auto newSize = dstPtr - data.data();
+    // Remosaic taps reach this far, the source must be larger than twice the quad bayer period plus this
+    constexpr int REMOSAIC_RADIUS = 3;
+    constexpr int REMOSAIC_MAX_TAPS = 4;
+    constexpr int REMOSAIC_WEIGHT_SHIFT = 8;
+
+    // Interpolation taps for each of the 16 positions of the 4x4 quad bayer period. A position takes the
+    // closest samples of the color the bayer pattern wants there, weighted by inverse squared distance.
+    struct RemosaicTable {
+        struct Phase {
+            int numTaps;
+            std::array<int, REMOSAIC_MAX_TAPS> dy;
+            std::array<int, REMOSAIC_MAX_TAPS> dx;
+            std::array<ptrdiff_t, REMOSAIC_MAX_TAPS> offset;
+            std::array<uint32_t, REMOSAIC_MAX_TAPS> weight;    // Sums to 1 << REMOSAIC_WEIGHT_SHIFT
+        };
+
+        std::array<Phase, 16> phases;
+    };
 
-    data.resize(newSize);
-}
+    RemosaicTable buildRemosaicTable(const std::array<uint8_t, 4>& cfa, size_t srcWidth) {
+        RemosaicTable table;
 
-void encodeTo6Bit(
-    std::vector<uint8_t>& data,
-    uint32_t& width,
-    uint32_t& height)
-{
-    Measure m("encodeTo6Bit");
-
-    uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
-    uint8_t* dstPtr = data.data();
-
-    for(int y = 0; y < height; y++) {
-        for(int x = 0; x < width; x+=4) {
-            const uint16_t p0 = srcPtr[0];
-            const uint16_t p1 = srcPtr[1];
-            const uint16_t p2 = srcPtr[2];
-            const uint16_t p3 = srcPtr[3];
-
-            // Pack 4 pixels (6 bits each) into 3 bytes - use lower 6 bits
-            const uint8_t v0 = p0 & 0x3F;
-            const uint8_t v1 = p1 & 0x3F;
-            const uint8_t v2 = p2 & 0x3F;
-            const uint8_t v3 = p3 & 0x3F;
-
-            dstPtr[0] = (v0 << 2) | (v1 >> 4);
-            dstPtr[1] = ((v1 & 0x0F) << 4) | (v2 >> 2);
-            dstPtr[2] = ((v2 & 0x03) << 6) | v3;
-
-            srcPtr += 4;
-            dstPtr += 3;
+        for (int py = 0; py < 4; py++) {
+            for (int px = 0; px < 4; px++) {
+                auto& phase = table.phases[py * 4 + px];
+                const uint8_t color = cfa[(py & 1) * 2 + (px & 1)];
+
+                // Candidates of the wanted color, the quad bayer color of a position is that of its 2x2 group
+                std::vector<std::pair<int, std::pair<int, int>>> candidates;
+
+                for (int dy = -REMOSAIC_RADIUS; dy <= REMOSAIC_RADIUS; dy++) {
+                    for (int dx = -REMOSAIC_RADIUS; dx <= REMOSAIC_RADIUS; dx++) {
+                        const int sy = py + dy + 4;
+                        const int sx = px + dx + 4;
+
+                        if (cfa[((sy >> 1) & 1) * 2 + ((sx >> 1) & 1)] == color)
+                            candidates.push_back({ dy * dy + dx * dx, { dy, dx } });
+                    }
+                }
+
+                std::sort(candidates.begin(), candidates.end());
+
+                // Samples up to twice the distance of the closest, a sample already in place is copied
+                const int maxDistance = std::max(1, candidates.front().first * 2);
+                std::array<float, REMOSAIC_MAX_TAPS> weights;
+                float totalWeight = 0.0f;
+
+                phase.numTaps = 0;
+
+                for (const auto& c : candidates) {
+                    if (c.first > maxDistance || phase.numTaps == REMOSAIC_MAX_TAPS || (candidates.front().first == 0 && phase.numTaps == 1))
+                        break;
+
+                    phase.dy[phase.numTaps] = c.second.first;
+                    phase.dx[phase.numTaps] = c.second.second;
+                    phase.offset[phase.numTaps] = c.second.first * static_cast<ptrdiff_t>(srcWidth) + c.second.second;
+
+                    weights[phase.numTaps] = (c.first == 0 ? 1.0f : 1.0f / c.first);
+                    totalWeight += weights[phase.numTaps];
+
+                    phase.numTaps++;
+                }
+
+                // Quantized weights must sum exactly to one so flat areas pass through unchanged
+                uint32_t remaining = 1 << REMOSAIC_WEIGHT_SHIFT;
+
+                for (int i = 1; i < phase.numTaps; i++) {
+                    phase.weight[i] = static_cast<uint32_t>(std::lround(weights[i] / totalWeight * (1 << REMOSAIC_WEIGHT_SHIFT)));
+                    remaining -= phase.weight[i];
+                }
+
+                phase.weight[0] = remaining;
+            }
         }
+
+        return table;
     }
 
-    // Resize to fit new data
-    auto newSize = dstPtr - data.data();
+    // Remosaics source row y of a quad bayer frame to the bayer pattern. Taps that fall outside the frame
+    // move back in by the quad bayer period so they keep their color.
+    void remosaicRow(const uint16_t* src, size_t srcWidth, size_t srcHeight, size_t y, uint16_t* dst, size_t width, const RemosaicTable& table) {
+        const RemosaicTable::Phase* phases = table.phases.data() + (y & 3) * 4;
+        const uint16_t* row = src + y * srcWidth;
 
-    data.resize(newSize);
-}
+        const bool interiorRow = (y >= REMOSAIC_RADIUS && y + REMOSAIC_RADIUS < srcHeight);
+        const size_t interiorEnd = std::min(width, srcWidth - REMOSAIC_RADIUS);
 
-void encodeTo4Bit(
-    std::vector<uint8_t>& data,
-    uint32_t& width,
-    uint32_t& height)
-{
-    Measure m("encodeTo4Bit");
+        auto sampleClamped = [&](size_t x, const RemosaicTable::Phase& phase) {
+            uint32_t sum = 0;
+
+            for (int i = 0; i < phase.numTaps; i++) {
+                ptrdiff_t sy = static_cast<ptrdiff_t>(y) + phase.dy[i];
+                ptrdiff_t sx = static_cast<ptrdiff_t>(x) + phase.dx[i];
+
+                if (sy < 0) sy += 4;
+                else if (sy >= static_cast<ptrdiff_t>(srcHeight)) sy -= 4;
 
-    uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
-    uint8_t* dstPtr = data.data();
+                if (sx < 0) sx += 4;
+                else if (sx >= static_cast<ptrdiff_t>(srcWidth)) sx -= 4;
 
-    for(int y = 0; y < height; y++) {
-        for(int x = 0; x < width; x+=2) {
-            const uint16_t p0 = srcPtr[0];
-            const uint16_t p1 = srcPtr[1];
+                sum += phase.weight[i] * src[sy * srcWidth + sx];
+            }
 
-            // Pack 2 pixels (4 bits each) into 1 byte - use lower 4 bits
-            const uint8_t v0 = p0 & 0x0F;
-            const uint8_t v1 = p1 & 0x0F;
+            return static_cast<uint16_t>((sum + (1 << (REMOSAIC_WEIGHT_SHIFT - 1))) >> REMOSAIC_WEIGHT_SHIFT);
+        };
 
-            dstPtr[0] = (v0 << 4) | v1;
+        if (!interiorRow) {
+            for (size_t x = 0; x < width; x++)
+                dst[x] = sampleClamped(x, phases[x & 3]);
 
-            srcPtr += 2;
-            dstPtr += 1;
+            return;
         }
-    }
 
-    // Resize to fit new data
-    auto newSize = dstPtr - data.data();
+        size_t x = 0;
 
-    data.resize(newSize);
-}
+        for (; x < REMOSAIC_RADIUS + 1; x++)
+            dst[x] = sampleClamped(x, phases[x & 3]);
 
-void encodeTo2Bit(
-    std::vector<uint8_t>& data,
-    uint32_t& width,
-    uint32_t& height)
-{
-    Measure m("encodeTo2Bit");
-
-    uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
-    uint8_t* dstPtr = data.data();
-
-    for(int y = 0; y < height; y++) {
-        for(int x = 0; x < width; x+=4) {
-            const uint16_t p0 = srcPtr[0];
-            const uint16_t p1 = srcPtr[1];
-            const uint16_t p2 = srcPtr[2];
-            const uint16_t p3 = srcPtr[3];
-
-            // Try different bit order: p3 in bits 1-0, p2 in bits 3-2, p1 in bits 5-4, p0 in bits 7-6
-            dstPtr[0] = ((p0 & 0x03) << 6) | 
-                       ((p1 & 0x03) << 4) | 
-                       ((p2 & 0x03) << 2) | 
-                       (p3 & 0x03);
-
-            srcPtr += 4;
-            dstPtr += 1;
+        // Aligned to the period so the phases of a group are fixed
+        for (; x + 4 <= interiorEnd; x += 4) {
+            for (int p = 0; p < 4; p++) {
+                const auto& phase = phases[p];
+                const uint16_t* s = row + x + p;
+                uint32_t sum = 1 << (REMOSAIC_WEIGHT_SHIFT - 1);
+
+                for (int i = 0; i < phase.numTaps; i++)
+                    sum += phase.weight[i] * s[phase.offset[i]];
+
+                dst[x + p] = static_cast<uint16_t>(sum >> REMOSAIC_WEIGHT_SHIFT);
+            }
         }
-    }
 
-    // Resize to fit new data
-    auto newSize = dstPtr - data.data();
+        for (; x < width; x++)
+            dst[x] = sampleClamped(x, phases[x & 3]);
+    }
 
-    data.resize(newSize);
 }
 
-
 tinydngwriter::OpcodeList createLensShadingOpcodeList(
     const CameraFrameMetadata& metadata,
     uint32_t imageWidth,
@@ -572,43 +577,83 @@ tinydngwriter::OpcodeList createLensShadingOpcodeList(
     return opcodeList;
 }
 
-std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short, tinydngwriter::OpcodeList> preprocessData(
+namespace {
+    // FNV-1a over the gains of all planes
+    uint64_t shadingMapHash(const CameraFrameMetadata& metadata) {
+        uint64_t hash = 14695981039346656037ULL;
+
+        auto mix = [&hash](const void* bytes, size_t size) {
+            const auto* p = static_cast<const uint8_t*>(bytes);
+            for(size_t i = 0; i < size; i++) {
+                hash ^= p[i];
+                hash *= 1099511628211ULL;
+            }
+        };
+
+        for(const auto& plane : metadata.lensShadingMap) {
+            const uint64_t planeSize = plane.size();
+
+            mix(&planeSize, sizeof(planeSize));
+            mix(plane.data(), plane.size() * sizeof(float));
+        }
+
+        return hash;
+    }
+}
+
+std::shared_ptr<const tinydngwriter::OpcodeList> getLensShadingOpcodeList(
+    const CameraFrameMetadata& metadata,
+    const RenderPlan& plan,
+    uint32_t imageWidth,
+    uint32_t imageHeight,
+    int left,
+    int top)
+{
+    const RenderPlan::OpcodeListKey key {
+        shadingMapHash(metadata),
+        metadata.lensShadingMapWidth,
+        metadata.lensShadingMapHeight,
+        imageWidth,
+        imageHeight,
+        left,
+        top
+    };
+
+    if(auto opcodeList = plan.findOpcodeList(key))
+        return opcodeList;
+
+    auto opcodeList = std::make_shared<const tinydngwriter::OpcodeList>(
+        createLensShadingOpcodeList(metadata, imageWidth, imageHeight, left, top));
+
+    plan.storeOpcodeList(key, opcodeList);
+
+    return opcodeList;
+}
+
+// Returns the packed data, black and white level, the largest stored code with the shift applied to stored codes
+// (see RenderPlan::codeShift) and the opcode list
+std::tuple<std::shared_ptr<const std::vector<uint8_t>>, std::array<unsigned short, 4>, unsigned short, unsigned short, unsigned short, std::shared_ptr<const tinydngwriter::OpcodeList>> preprocessData(
     std::vector<uint8_t>& data,
     uint32_t& inOutWidth,
     uint32_t& inOutHeight,
     const CameraFrameMetadata& metadata,
-    const CameraConfiguration& cameraConfiguration,
-    const std::array<uint8_t, 4>& cfa,
-    uint32_t scale,
-    bool applyShadingMap,
-    bool vignetteOnlyColor,
-    bool normaliseShadingMap,
-    bool debugShadingMap,
+    const RenderPlan& plan,
     bool interpretAsQuadBayer,
-    std::string cropTarget,
-    std::string levels,
-    LogTransformMode logTransform,
-    QuadBayerMode quadBayerOption,
-    bool includeOpcode)
+    bool includeOpcode,
+    BS::thread_pool* pool)
 {
-    scale = (scale > 1 ? (scale / 2) * 2 : 1); // Ensure even scale for downscaling
+    const uint32_t scale = plan.scale;
+    const auto& cfa = plan.cfa;
+    const bool applyShadingMap = plan.applyShadingMap;
+    const bool vignetteOnlyColor = plan.vignetteOnlyColor;
+    const bool normaliseShadingMap = plan.normalizeShadingMap;
+    const bool debugShadingMap = plan.debugShadingMap;
+    const LogTransformMode logTransform = plan.settings.logTransform;
 
     uint32_t cfaSize = (interpretAsQuadBayer ? 2 : 1);  //assume quadbayer for now
 
     uint32_t newWidth, newHeight;
-    uint32_t cropWidth = 0, cropHeight = 0;
-
-    if (!cropTarget.empty()) {
-        const size_t separatorPos = cropTarget.find('x');
-        if (separatorPos != std::string::npos) {
-            try {
-                cropWidth = std::stoul(cropTarget.substr(0, separatorPos));
-                cropHeight = std::stoul(cropTarget.substr(separatorPos + 1));
-            } catch (const std::exception&) {
-                // Ignore invalid crop target
-                cropWidth = 0;
-                cropHeight = 0;
-    }}}
+    uint32_t cropWidth = plan.cropWidth, cropHeight = plan.cropHeight;
 
     if (cropWidth > 0 && cropHeight > 0 && cropWidth <= inOutWidth && cropHeight <= inOutHeight) {
         newWidth = cropWidth / scale;
@@ -623,61 +668,9 @@ std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short,
     newWidth = (newWidth / 4) * 4;
     newHeight = (newHeight / 4) * 4;    
 
-    auto srcBlackLevel = metadata.dynamicBlackLevel;
-    auto srcWhiteLevel = metadata.dynamicWhiteLevel;
-
-    if (levels == "Static") {
-        srcBlackLevel = cameraConfiguration.blackLevel;
-        srcWhiteLevel = cameraConfiguration.whiteLevel;
-    } else if (!levels.empty()) {
-        const size_t separatorPos = levels.find('/');
-        if (separatorPos != std::string::npos) {
-            try {
-                const std::string whiteLevelStr = levels.substr(0, separatorPos);
-                const std::string blackLevelStr = levels.substr(separatorPos + 1);
-                
-                // Parse white level (int or float)
-                if (whiteLevelStr.find('.') != std::string::npos) 
-                    srcWhiteLevel = std::stof(whiteLevelStr);
-                else 
-                    srcWhiteLevel = std::stoul(whiteLevelStr);                
-                
-                // Parse black level (single value or comma-separated values)
-                if (blackLevelStr.find(',') != std::string::npos) {
-                    // Parse comma-separated values
-                    std::array<float, 4> blackValues = {0.0f, 0.0f, 0.0f, 0.0f};
-                    size_t start = 0;
-                    size_t valueIndex = 0;
-                    
-                    while (start < blackLevelStr.length() && valueIndex < 4) {
-                        size_t commaPos = blackLevelStr.find(',', start);
-                        if (commaPos == std::string::npos) commaPos = blackLevelStr.length();
-                        
-                        std::string valueStr = blackLevelStr.substr(start, commaPos - start);
-                        if (valueStr.find('.') != std::string::npos) {
-                            blackValues[valueIndex] = std::stof(valueStr);
-                        } else {
-                            blackValues[valueIndex] = std::stoul(valueStr);
-                        }
-                        
-                        valueIndex++;
-                        start = commaPos + 1;
-                    }                    
-                    srcBlackLevel = blackValues;
-                } else {
-                    // Parse single value for all channels
-                    float blackLevelValue;
-                    if (blackLevelStr.find('.') != std::string::npos) 
-                        blackLevelValue = std::stof(blackLevelStr);
-                    else 
-                        blackLevelValue = std::stoul(blackLevelStr);                                
-                    srcBlackLevel = {blackLevelValue, blackLevelValue, blackLevelValue, blackLevelValue};
-                }
-            } catch (const std::exception&) {
-                // Handle exception silently
-            }
-        }
-    }
+    // Levels from the plan override the dynamic levels of the frame
+    auto srcBlackLevel = plan.blackLevel.value_or(metadata.dynamicBlackLevel);
+    auto srcWhiteLevel = plan.whiteLevel.value_or(metadata.dynamicWhiteLevel);
 
     if(cfaSize > 1 && scale == 2) {
         srcWhiteLevel *= cfaSize * cfaSize;
@@ -775,381 +768,405 @@ std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short,
     }
 
     // Create opcode list if requested and shading map is not applied to image data
-    tinydngwriter::OpcodeList opcodeList2;
+    std::shared_ptr<const tinydngwriter::OpcodeList> opcodeList2;
     if(includeOpcode && !applyShadingMap) {
         // Create lens shading map as opcode list 2 gain map
-        opcodeList2 = createLensShadingOpcodeList(metadata, inOutWidth, inOutHeight, left, top);
+        opcodeList2 = getLensShadingOpcodeList(metadata, plan, inOutWidth, inOutHeight, left, top);
     }
 
     //
     // Preprocess data
     //
 
-    uint32_t originalWidth = inOutWidth;
-    uint32_t dstOffset = 0;
+    const uint32_t originalWidth = inOutWidth;
+    const uint32_t originalHeight = inOutHeight;
 
     // Reinterpret the input data as uint16_t for reading
-    uint16_t* srcData = reinterpret_cast<uint16_t*>(data.data());
-
-    // Process the image by copying and packing 2x2 Bayer blocks
-    std::array<float, 16> shadingMapVals;
-    shadingMapVals.fill(1.0f);
-    std::vector<uint8_t> dst;
-    dst.resize(sizeof(uint16_t) * newWidth * newHeight);
-    uint16_t* dstData = reinterpret_cast<uint16_t*>(dst.data());
-
-    for (auto y = 0; y < newHeight; y += 2 * (scale < 2 ? cfaSize : 1)) {
-        for (auto x = 0; x < newWidth; x += 2 * (scale < 2 ? cfaSize : 1)) {
-            // Get the source coordinates (scaled)
-            uint32_t srcY = y * scale;
-            uint32_t srcX = x * scale;            
- 
-            if (cfaSize < 2 | scale > 1) {
-                std::array<uint16_t, 4> s;
-                if (cfaSize == 2 && scale == 2) {                    
-                    s[0] = srcData[srcY * originalWidth + srcX] + srcData[srcY * originalWidth + srcX + 1] + srcData[(srcY + 1) * originalWidth + srcX] + srcData[(srcY + 1) * originalWidth + srcX + 1];
-                    s[1] = srcData[srcY * originalWidth + srcX + 2] + srcData[srcY * originalWidth + srcX + 3] + srcData[(srcY + 1) * originalWidth + srcX + 2] + srcData[(srcY + 1) * originalWidth + srcX + 3];
-                    s[2] = srcData[(srcY + 2) * originalWidth + srcX] + srcData[(srcY + 2) * originalWidth + srcX + 1] + srcData[(srcY + 3) * originalWidth + srcX] + srcData[(srcY + 3) * originalWidth + srcX + 1];
-                    s[3] = srcData[(srcY + 2) * originalWidth + srcX + 2] + srcData[(srcY + 2) * originalWidth + srcX + 3] + srcData[(srcY + 3) * originalWidth + srcX + 2] + srcData[(srcY + 3) * originalWidth + srcX + 3];
-                } else {
-                    s[0] = srcData[srcY * originalWidth + srcX];
-                    s[1] = srcData[srcY * originalWidth + srcX + cfaSize];
-                    s[2] = srcData[(srcY + cfaSize) * originalWidth + srcX];
-                    s[3] = srcData[(srcY + cfaSize) * originalWidth + srcX + cfaSize];
-                }                
-                
-                if(applyShadingMap) {                              
-                    // Calculate position in shading map     
-                    shadingMapVals[0] = getShadingMapValue((srcX + left) * shadingMapScaleX, (srcY + top) * shadingMapScaleY, cfa[0], lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[1] = getShadingMapValue((srcX + left + scale) * shadingMapScaleX, (srcY + top) * shadingMapScaleY, cfa[1], lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[2] = getShadingMapValue((srcX + left) * shadingMapScaleX, (srcY + top + scale) * shadingMapScaleY, cfa[2], lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[3] = getShadingMapValue((srcX + left + scale) * shadingMapScaleX, (srcY + top + scale) * shadingMapScaleY, cfa[3], lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                }
+    const uint16_t* srcData = reinterpret_cast<const uint16_t*>(data.data());
 
-                std::array<float, 4> p;
-
-                if(debugShadingMap) {
-                    for (int i = 0; i < 4; i++)
-                        p[i] = std::max(0.0f, linear[i] * (srcWhiteLevel - srcBlackLevel[i]) * shadingMapVals[i]) * (dstWhiteLevel - dstBlackLevel[i]);
-                } else if (logTransform == LogTransformMode::Disabled) {               // Linearize and (maybe) apply shading map
-                    for (int i = 0; i < 4; i++)
-                        p[i] = std::max(0.0f, linear[i] * (s[i] - srcBlackLevel[i]) * shadingMapVals[i]) * (dstWhiteLevel - dstBlackLevel[i]);
-                } else {                                
-                    std::array<float, 4> dither; // Apply logarithmic tone mapping with triangular dithering. Generate improved triangular dither with better randomization                                    
-                    for (int i = 0; i < 4; i++) { // Use different seeds for each pixel in the 2x2 block to avoid correlation                    
-                        uint32_t seed = ((x + (i & 1)) * 1664525 + (y + (i >> 1)) * 1013904223) ^ 0xdeadbeef; // Create unique seed for each pixel using position and pixel index
-                        // Apply multiple hash iterations to improve randomness
-                        seed ^= seed >> 16; seed *= 0x85ebca6b; seed ^= seed >> 13; seed *= 0xc2b2ae35; seed ^= seed >> 16;                    
-                        // Generate triangular dither: sum of two uniform random values
-                        float r1 = (seed & 0xffff) / 65535.0f; float r2 = ((seed >> 16) & 0xffff) / 65535.0f;                    
-                        // Triangular distribution: r1 + r2 - 1, range [-1, 1] Scale down for subtle dithering appropriate for log encoding
-                        dither[i] = (r1 + r2 - 1.0f) * 0.5f;
-                        // Apply log2 transform that preserves black and white levels as identity points
-                        float logValue = std::log2(1.0f + 60.0f * std::max(0.0f, linear[i] * (s[i] - srcBlackLevel[i]) * shadingMapVals[i])) / std::log2(61.0f);                  
-                        p[i] = (logValue) * dstWhiteLevel + dither[i]; // Scale by dstWhiteLevel to match what the linearization table expects
-                    }
-                }            
-                
-                for (int i = 0; i < 4; i++)
-                    s[i] = std::clamp(std::round((p[i] + dstBlackLevel[i])), 0.f, dstWhiteLevel);
+    // The kernel is selected by the plan, only the white level of the frame decides about the fixed point variant
+    const KernelSelection& selection = plan.kernels[interpretAsQuadBayer];
+    const KernelLayout layout = selection.layout;
 
-                // Copy the 2x2 Bayer block
-                dstData[dstOffset]                 = static_cast<unsigned short>(s[0]);
-                dstData[dstOffset + 1]             = static_cast<unsigned short>(s[1]);
-                dstData[dstOffset + newWidth]      = static_cast<unsigned short>(s[2]);
-                dstData[dstOffset + newWidth + 1]  = static_cast<unsigned short>(s[3]);
+    KernelTransform transform = selection.transform;
 
-                dstOffset += 2;
-            } else {
-                std::array<uint16_t, 16> s = {                
-                    srcData[srcY * originalWidth + srcX], srcData[srcY * originalWidth + srcX + 1], srcData[(srcY + 1) * originalWidth + srcX], srcData[(srcY + 1) * originalWidth + srcX + 1],
-                    srcData[srcY * originalWidth + srcX + 2], srcData[srcY * originalWidth + srcX + 3], srcData[(srcY + 1) * originalWidth + srcX + 2], srcData[(srcY + 1) * originalWidth + srcX + 3],
-                    srcData[(srcY + 2) * originalWidth + srcX], srcData[(srcY + 2) * originalWidth + srcX + 1], srcData[(srcY + 3) * originalWidth + srcX], srcData[(srcY + 3) * originalWidth + srcX + 1],
-                    srcData[(srcY + 2) * originalWidth + srcX + 2], srcData[(srcY + 2) * originalWidth + srcX + 3], srcData[(srcY + 3) * originalWidth + srcX + 2], srcData[(srcY + 3) * originalWidth + srcX + 3]
-                };
-
-                if(applyShadingMap) { 
-                    // Calculate position in shading map     
-                    shadingMapVals[0] = getShadingMapValue((srcX + left) * shadingMapScaleX, (srcY + top) * shadingMapScaleY, 0, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[1] = getShadingMapValue((srcX + left + 1) * shadingMapScaleX, (srcY + top) * shadingMapScaleY, 0, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[2] = getShadingMapValue((srcX + left) * shadingMapScaleX, (srcY + top + 1) * shadingMapScaleY, 0, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[3] = getShadingMapValue((srcX + left + 1) * shadingMapScaleX, (srcY + top + 1) * shadingMapScaleY, 0, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[4] = getShadingMapValue((srcX + left + cfaSize * 2) * shadingMapScaleX, (srcY + top) * shadingMapScaleY, 1, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[5] = getShadingMapValue((srcX + left + cfaSize * 2 + 1) * shadingMapScaleX, (srcY + top) * shadingMapScaleY, 1, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[6] = getShadingMapValue((srcX + left + cfaSize * 2) * shadingMapScaleX, (srcY + top + 1) * shadingMapScaleY, 1, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[7] = getShadingMapValue((srcX + left + cfaSize * 2 + 1) * shadingMapScaleX, (srcY + top + 1) * shadingMapScaleY, 1, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[8] = getShadingMapValue((srcX + left) * shadingMapScaleX, (srcY + top + cfaSize * 2) * shadingMapScaleY, 2, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[9] = getShadingMapValue((srcX + left + 1) * shadingMapScaleX, (srcY + top + cfaSize * 2) * shadingMapScaleY, 2, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[10] = getShadingMapValue((srcX + left) * shadingMapScaleX, (srcY + top + cfaSize * 2 + 1) * shadingMapScaleY, 2, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[11] = getShadingMapValue((srcX + left + 1) * shadingMapScaleX, (srcY + top + cfaSize * 2 + 1) * shadingMapScaleY, 2, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[12] = getShadingMapValue((srcX + left + cfaSize * 2) * shadingMapScaleX, (srcY + top + cfaSize * 2) * shadingMapScaleY, 3, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[13] = getShadingMapValue((srcX + left + cfaSize * 2 + 1) * shadingMapScaleX, (srcY + top + cfaSize * 2) * shadingMapScaleY, 3, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[14] = getShadingMapValue((srcX + left + cfaSize * 2) * shadingMapScaleX, (srcY + top + cfaSize * 2 + 1) * shadingMapScaleY, 3, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                    shadingMapVals[15] = getShadingMapValue((srcX + left + cfaSize * 2 + 1) * shadingMapScaleX, (srcY + top + cfaSize * 2 + 1) * shadingMapScaleY, 3, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
-                }
+    if (srcWhiteLevel <= selection.fixedPointMaxInput) {
+        if (transform == KernelTransform::Linear)
+            transform = KernelTransform::LinearFixed;
+        else if (transform == KernelTransform::Log)
+            transform = KernelTransform::LogFixed;
+    }
 
-                std::array<float, 16> p;
+    // Combinations without a kernel of their own fall back to the float kernels
+    if (!hasKernel(applyShadingMap, layout, transform) && transform != KernelTransform::DebugShading)
+        transform = (transform == KernelTransform::LogFixed ? KernelTransform::Log : KernelTransform::Linear);
 
-                for (int i = 0; i < 16; i++)
-                    p[i] = linear[i%4] * (s[i] - srcBlackLevel[i%4]) * shadingMapVals[i];
+    // Linear output without the shading map holds the source codes, with adaptive bit depth it is limited to the
+    // codes the clip uses. Remosaiced samples are interpolated and keep their low bits.
+    float storedMaxLevel = dstWhiteLevel;
+    uint32_t codeShift = 0;
 
-                std::array<float, 48> d;
+    if ((transform == KernelTransform::Linear || transform == KernelTransform::LinearFixed) && !applyShadingMap &&
+        layout != KernelLayout::QuadBayerRemosaic) {
+        if (plan.codeCeiling > 0)
+            storedMaxLevel = std::min(dstWhiteLevel, static_cast<float>(plan.codeCeiling * (layout == KernelLayout::QuadBayerBinned ? 4 : 1)));
 
-                std::array<float, 16> r;
+        codeShift = plan.codeShift;
+    }
 
-                /*if(cfaSize > 1 && (quadBayerOption == "Remosaic" || quadBayerOption == "Demosaic only")) {
-                    // Quad Bayer demosaic - simplified bilinear interpolation
-                    // p[16] contains 4x4 Quad Bayer block, d[48] will contain 16 RGB pixels
-                    
-                    // Simple bilinear interpolation for Quad Bayer and remosaic to normal Bayer
-                    for(int py = 0; py < 4; py++) {
-                        for(int px = 0; px < 4; px++) {
-                            int idx = py * 4 + px;
-                            int outIdx = idx * 3;
-                            
-                            // Determine which color this pixel is based on CFA pattern
-                            // For Quad Bayer, each 2x2 block has the same color
-                            int cfaIdx = ((py / 2) % 2) * 2 + ((px / 2) % 2);
-                            int color = cfa[cfaIdx];
-                            
-                            float red = 0, green = 0, blue = 0;
-                            
-                            if(color == 0) { // Red pixel
-                                red = p[idx];
-                                // Interpolate green from neighbors
-                                float gSum = 0; int gCount = 0;
-                                if(px > 0 && cfa[(((py / 2) % 2)) * 2 + (((px-1) / 2) % 2)] == 1) { gSum += p[idx-1]; gCount++; }
-                                if(px < 3 && cfa[(((py / 2) % 2)) * 2 + (((px+1) / 2) % 2)] == 1) { gSum += p[idx+1]; gCount++; }
-                                if(py > 0 && cfa[(((py-1) / 2) % 2) * 2 + ((px / 2) % 2)] == 1) { gSum += p[idx-4]; gCount++; }
-                                if(py < 3 && cfa[(((py+1) / 2) % 2) * 2 + ((px / 2) % 2)] == 1) { gSum += p[idx+4]; gCount++; }
-                                green = gCount > 0 ? gSum / gCount : p[idx];
-                                // Interpolate blue from diagonals
-                                float bSum = 0; int bCount = 0;
-                                if(px > 0 && py > 0 && cfa[(((py-1) / 2) % 2) * 2 + (((px-1) / 2) % 2)] == 2) { bSum += p[idx-5]; bCount++; }
-                                if(px < 3 && py > 0 && cfa[(((py-1) / 2) % 2) * 2 + (((px+1) / 2) % 2)] == 2) { bSum += p[idx-3]; bCount++; }
-                                if(px > 0 && py < 3 && cfa[(((py+1) / 2) % 2) * 2 + (((px-1) / 2) % 2)] == 2) { bSum += p[idx+3]; bCount++; }
-                                if(px < 3 && py < 3 && cfa[(((py+1) / 2) % 2) * 2 + (((px+1) / 2) % 2)] == 2) { bSum += p[idx+5]; bCount++; }
-                                blue = bCount > 0 ? bSum / bCount : p[idx];
-                            }
-                            else if(color == 1) { // Green pixel
-                                green = p[idx];
-                                // Interpolate red and blue from neighbors
-                                float rSum = 0, bSum = 0; int rCount = 0, bCount = 0;
-                                if(px > 0) { 
-                                    int c = cfa[(((py / 2) % 2)) * 2 + (((px-1) / 2) % 2)];
-                                    if(c == 0) { rSum += p[idx-1]; rCount++; }
-                                    else if(c == 2) { bSum += p[idx-1]; bCount++; }
-                                }
-                                if(px < 3) {
-                                    int c = cfa[(((py / 2) % 2)) * 2 + (((px+1) / 2) % 2)];
-                                    if(c == 0) { rSum += p[idx+1]; rCount++; }
-                                    else if(c == 2) { bSum += p[idx+1]; bCount++; }
-                                }
-                                if(py > 0) {
-                                    int c = cfa[(((py-1) / 2) % 2) * 2 + ((px / 2) % 2)];
-                                    if(c == 0) { rSum += p[idx-4]; rCount++; }
-                                    else if(c == 2) { bSum += p[idx-4]; bCount++; }
-                                }
-                                if(py < 3) {
-                                    int c = cfa[(((py+1) / 2) % 2) * 2 + ((px / 2) % 2)];
-                                    if(c == 0) { rSum += p[idx+4]; rCount++; }
-                                    else if(c == 2) { bSum += p[idx+4]; bCount++; }
-                                }
-                                red = rCount > 0 ? rSum / rCount : p[idx];
-                                blue = bCount > 0 ? bSum / bCount : p[idx];
-                            }
-                            else { // Blue pixel
-                                blue = p[idx];
-                                // Interpolate green from neighbors
-                                float gSum = 0; int gCount = 0;
-                                if(px > 0 && cfa[(((py / 2) % 2)) * 2 + (((px-1) / 2) % 2)] == 1) { gSum += p[idx-1]; gCount++; }
-                                if(px < 3 && cfa[(((py / 2) % 2)) * 2 + (((px+1) / 2) % 2)] == 1) { gSum += p[idx+1]; gCount++; }
-                                if(py > 0 && cfa[(((py-1) / 2) % 2) * 2 + ((px / 2) % 2)] == 1) { gSum += p[idx-4]; gCount++; }
-                                if(py < 3 && cfa[(((py+1) / 2) % 2) * 2 + ((px / 2) % 2)] == 1) { gSum += p[idx+4]; gCount++; }
-                                green = gCount > 0 ? gSum / gCount : p[idx];
-                                // Interpolate red from diagonals
-                                float rSum = 0; int rCount = 0;
-                                if(px > 0 && py > 0 && cfa[(((py-1) / 2) % 2) * 2 + (((px-1) / 2) % 2)] == 0) { rSum += p[idx-5]; rCount++; }
-                                if(px < 3 && py > 0 && cfa[(((py-1) / 2) % 2) * 2 + (((px+1) / 2) % 2)] == 0) { rSum += p[idx-3]; rCount++; }
-                                if(px > 0 && py < 3 && cfa[(((py+1) / 2) % 2) * 2 + (((px-1) / 2) % 2)] == 0) { rSum += p[idx+3]; rCount++; }
-                                if(px < 3 && py < 3 && cfa[(((py+1) / 2) % 2) * 2 + (((px+1) / 2) % 2)] == 0) { rSum += p[idx+5]; rCount++; }
-                                red = rCount > 0 ? rSum / rCount : p[idx];
-                            }
-                            
-                            // Store demosaiced RGB
-                            d[outIdx] = red;
-                            d[outIdx + 1] = green;
-                            d[outIdx + 2] = blue;
-                            
-                            // Remosaic to normal Bayer - extract appropriate channel based on normal Bayer CFA pattern
-                            int bayerCfaIdx = (py % 2) * 2 + (px % 2);
-                            int bayerColor = cfa[bayerCfaIdx];
-                            
-                            //if(bayerColor == 0) { // Red position in normal Bayer
-                                r[idx] = red;
-                            //}
-                            //else if(bayerColor == 1) { // Green position in normal Bayer
-                                //r[idx] = green;
-                            //}
-                            //else { // Blue position in normal Bayer
-                              //  r[idx] = blue;
-                            //}
+    const unsigned short storedWhiteLevel = static_cast<unsigned short>(storedMaxLevel) >> codeShift;
+
+    // Output is packed to the smallest container that fits the stored codes
+    const unsigned short bits = packedBits(storedWhiteLevel);
+    const size_t packedStride = static_cast<size_t>(newWidth) * bits / 8;
+
+    std::array<unsigned short, 4> blackLevelResult;
+
+    for(auto i = 0; i < dstBlackLevel.size(); ++i)
+        blackLevelResult[i] = static_cast<unsigned short>(std::round(dstBlackLevel[i]));
+
+    // The debug output does not read the frame, reuse it for every frame with the same shading map and levels
+    std::optional<RenderPlan::PayloadKey> payloadKey;
+
+    if (transform == KernelTransform::DebugShading) {
+        payloadKey = RenderPlan::PayloadKey {
+            shadingMapHash(metadata),
+            metadata.lensShadingMapWidth,
+            metadata.lensShadingMapHeight,
+            inOutWidth,
+            inOutHeight,
+            fullWidth,
+            fullHeight,
+            srcBlackLevel,
+            srcWhiteLevel
+        };
+
+        if (auto payload = plan.findPayload(*payloadKey)) {
+            inOutWidth = newWidth;
+            inOutHeight = newHeight;
+
+            return std::make_tuple(std::move(payload), blackLevelResult, static_cast<unsigned short>(dstWhiteLevel), storedWhiteLevel,
+                                   static_cast<unsigned short>(codeShift), std::move(opcodeList2));
+        }
+    }
+
+    auto dst = std::make_shared<std::vector<uint8_t>>(packedStride * newHeight);
+    uint8_t* dstData = dst->data();
+
+    const uint32_t rowStep = (layout == KernelLayout::QuadBayer ? 4 : 2);
+
+    // Dither tiles are generated on first use
+    const auto* logDither = (transform == KernelTransform::Log ? &ditherTiles() : nullptr);
+    const auto* logDitherFixed = (transform == KernelTransform::LogFixed ? &ditherTilesFixed() : nullptr);
+
+    // Remosaic taps depend on the source width, so the table is built per frame
+    std::optional<RemosaicTable> remosaicTable;
+    if (layout == KernelLayout::QuadBayerRemosaic && transform != KernelTransform::DebugShading)
+        remosaicTable = buildRemosaicTable(cfa, originalWidth);
+
+    // Tables of the integer pipeline. Samples from the white level up all saturate, so the tables end there.
+    const uint32_t fixedPointMaxIndex = static_cast<uint32_t>(std::ceil(std::max(0.0f, srcWhiteLevel)));
+    const int32_t fixedPointWhiteLevel = static_cast<int32_t>(dstWhiteLevel);
+
+    std::array<std::vector<uint16_t>, 4> linearTables;
+    std::array<std::vector<int32_t>, 4> logTables;
+
+    if (transform == KernelTransform::LinearFixed) {
+        for (int c = 0; c < 4; c++)
+            linearTables[c] = linearTable(linear[c], srcBlackLevel[c], dstWhiteLevel, dstBlackLevel[c], storedMaxLevel, codeShift, fixedPointMaxIndex);
+    }
+    else if (transform == KernelTransform::LogFixed) {
+        for (int c = 0; c < 4; c++)
+            logTables[c] = logTable(linear[c], srcBlackLevel[c], dstWhiteLevel, dstBlackLevel[c], fixedPointMaxIndex);
+    }
+
+    // Each row group only writes its own rows of dst, so bands of rows are processed independently.
+    // Samples are packed as they are computed.
+    auto processRows = [&](auto bitsTag, auto shadingTag, auto layoutTag, auto transformTag, uint32_t yBegin, uint32_t yEnd) {
+        constexpr bool Shading = decltype(shadingTag)::value;
+        constexpr KernelLayout Layout = decltype(layoutTag)::value;
+        constexpr KernelTransform Transform = decltype(transformTag)::value;
+        constexpr uint32_t Step = (Layout == KernelLayout::QuadBayer ? 4 : 2);
+
+        std::array<PackedRowWriter<decltype(bitsTag)::value>, 4> rows;
+
+        std::array<float, 16> shadingMapVals;
+        shadingMapVals.fill(1.0f);
+
+        // Binned or remosaiced rows of the current row pair
+        std::vector<uint16_t> binned;
+        if constexpr ((Layout == KernelLayout::QuadBayerBinned || Layout == KernelLayout::QuadBayerRemosaic) &&
+                      Transform != KernelTransform::DebugShading)
+            binned.resize(2 * newWidth);
+
+        for (int y = static_cast<int>(yBegin); y < static_cast<int>(yEnd); y += Step) {
+            for (uint32_t r = 0; r < Step; r++)
+                rows[r].reset(dstData + (y + r) * packedStride);
+
+            if constexpr (Layout == KernelLayout::QuadBayerBinned && Transform != KernelTransform::DebugShading) {
+                const uint16_t* src = srcData + static_cast<size_t>(y) * scale * originalWidth;
+
+                binRowPair(src, src + originalWidth, binned.data(), newWidth);
+                binRowPair(src + 2 * originalWidth, src + 3 * originalWidth, binned.data() + newWidth, newWidth);
+            }
+            else if constexpr (Layout == KernelLayout::QuadBayerRemosaic && Transform != KernelTransform::DebugShading) {
+                remosaicRow(srcData, originalWidth, originalHeight, y, binned.data(), newWidth, *remosaicTable);
+                remosaicRow(srcData, originalWidth, originalHeight, y + 1, binned.data() + newWidth, newWidth, *remosaicTable);
+            }
+
+            // Without the shading map binned rows go through the tables in place and are packed a row at a time
+            if constexpr (Layout == KernelLayout::QuadBayerBinned &&
+                          (Transform == KernelTransform::LinearFixed || Transform == KernelTransform::LogFixed)) {
+                for (uint32_t r = 0; r < 2; r++) {
+                    uint16_t* row = binned.data() + r * newWidth;
+
+                    if constexpr (Transform == KernelTransform::LinearFixed) {
+                        const uint16_t* table0 = linearTables[2*r].data();
+                        const uint16_t* table1 = linearTables[2*r + 1].data();
+
+                        for (uint32_t x = 0; x < newWidth; x += 2) {
+                            row[x] = table0[std::min<uint32_t>(row[x], fixedPointMaxIndex)];
+                            row[x + 1] = table1[std::min<uint32_t>(row[x + 1], fixedPointMaxIndex)];
+                        }
+                    } else {
+                        const int32_t* table0 = logTables[2*r].data();
+                        const int32_t* table1 = logTables[2*r + 1].data();
+                        const int16_t* dither0 = (*logDitherFixed)[2*r].data() + ((y / 2) & DITHER_MASK) * DITHER_SIZE;
+                        const int16_t* dither1 = (*logDitherFixed)[2*r + 1].data() + ((y / 2) & DITHER_MASK) * DITHER_SIZE;
+
+                        for (uint32_t x = 0; x < newWidth; x += 2) {
+                            row[x] = storeLogFixed(table0[std::min<uint32_t>(row[x], fixedPointMaxIndex)], dither0[(x / 2) & DITHER_MASK], fixedPointWhiteLevel);
+                            row[x + 1] = storeLogFixed(table1[std::min<uint32_t>(row[x + 1], fixedPointMaxIndex)], dither1[(x / 2) & DITHER_MASK], fixedPointWhiteLevel);
                         }
                     }
-                    p = r;
-                }*/
 
+                    packRow<decltype(bitsTag)::value>(row, dstData + (y + r) * packedStride, newWidth);
+                }
 
-                if (logTransform == LogTransformMode::Disabled) {               // Linearize and (maybe) apply shading map
-                    for (int i = 0; i < 16; i++)
-                        p[i] = std::max(0.0f, p[i] * (dstWhiteLevel - dstBlackLevel[i%4]));
-                } else {                                
-                    std::array<float, 16> dither; // Apply logarithmic tone mapping with triangular dithering. Generate improved triangular dither with better randomization                                    
-                    for (int i = 0; i < 16; i++) { // Use different seeds for each pixel in the 2x2 block to avoid correlation                    
-                        uint32_t seed = ((x + (i & 1)) * 1664525 + (y + (i >> 1)) * 1013904223) ^ 0xdeadbeef; // Create unique seed for each pixel using position and pixel index
-                        // Apply multiple hash iterations to improve randomness
-                        seed ^= seed >> 16; seed *= 0x85ebca6b; seed ^= seed >> 13; seed *= 0xc2b2ae35; seed ^= seed >> 16;                    
-                        // Generate triangular dither: sum of two uniform random values
-                        float r1 = (seed & 0xffff) / 65535.0f; float r2 = ((seed >> 16) & 0xffff) / 65535.0f;                    
-                        // Triangular distribution: r1 + r2 - 1, range [-1, 1] Scale down for subtle dithering appropriate for log encoding
-                        dither[i] = (r1 + r2 - 1.0f) * 0.5f;
-                        // Apply log2 transform that preserves black and white levels as identity points
-                        float logValue = std::log2(1.0f + 60.0f * std::max(0.0f, p[i])) / std::log2(61.0f);                  
-                        p[i] = (logValue) * dstWhiteLevel + dither[i]; // Scale by dstWhiteLevel to match what the linearization table expects
+                continue;
+            }
+
+            for (auto x = 0; x < newWidth; x += Step) {
+                // Get the source coordinates (scaled)
+                uint32_t srcY = y * scale;
+                uint32_t srcX = x * scale;            
+ 
+                if constexpr (Layout != KernelLayout::QuadBayer) {
+                    std::array<uint16_t, 4> s;
+                    if constexpr (Transform == KernelTransform::DebugShading) {
+                        // Output only depends on the shading map
+                    } else if constexpr (Layout == KernelLayout::QuadBayerBinned || Layout == KernelLayout::QuadBayerRemosaic) {
+                        s[0] = binned[x];
+                        s[1] = binned[x + 1];
+                        s[2] = binned[newWidth + x];
+                        s[3] = binned[newWidth + x + 1];
+                    } else {
+                        s[0] = srcData[srcY * originalWidth + srcX];
+                        s[1] = srcData[srcY * originalWidth + srcX + cfaSize];
+                        s[2] = srcData[(srcY + cfaSize) * originalWidth + srcX];
+                        s[3] = srcData[(srcY + cfaSize) * originalWidth + srcX + cfaSize];
+                    }                
+                
+                    if constexpr (Shading) {
+                        // Calculate position in shading map     
+                        shadingMapVals[0] = getShadingMapValue((srcX + left) * shadingMapScaleX, (srcY + top) * shadingMapScaleY, cfa[0], lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[1] = getShadingMapValue((srcX + left + scale) * shadingMapScaleX, (srcY + top) * shadingMapScaleY, cfa[1], lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[2] = getShadingMapValue((srcX + left) * shadingMapScaleX, (srcY + top + scale) * shadingMapScaleY, cfa[2], lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[3] = getShadingMapValue((srcX + left + scale) * shadingMapScaleX, (srcY + top + scale) * shadingMapScaleY, cfa[3], lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                    }
+
+                    if constexpr (Transform == KernelTransform::LinearFixed) {
+                        for (int i = 0; i < 4; i++)
+                            s[i] = linearTables[i][std::min<uint32_t>(s[i], fixedPointMaxIndex)];
+                    } else if constexpr (Transform == KernelTransform::LogFixed) {
+                        const auto& dither = *logDitherFixed;
+                        const int ditherIndex = ((y / 2) & DITHER_MASK) * DITHER_SIZE + ((x / 2) & DITHER_MASK);
+
+                        for (int i = 0; i < 4; i++)
+                            s[i] = storeLogFixed(logTables[i][std::min<uint32_t>(s[i], fixedPointMaxIndex)], dither[i][ditherIndex], fixedPointWhiteLevel);
+                    } else {
+                        std::array<float, 4> p;
+
+                        if constexpr (Transform == KernelTransform::DebugShading) {
+                            for (int i = 0; i < 4; i++)
+                                p[i] = linearLevel(srcWhiteLevel, linear[i], srcBlackLevel[i], shadingMapVals[i], dstWhiteLevel - dstBlackLevel[i]);
+                        } else if constexpr (Transform == KernelTransform::Linear) {               // Linearize and (maybe) apply shading map
+                            for (int i = 0; i < 4; i++)
+                                p[i] = linearLevel(s[i], linear[i], srcBlackLevel[i], shadingMapVals[i], dstWhiteLevel - dstBlackLevel[i]);
+                        } else {                                
+                            // Apply logarithmic tone mapping with blue noise dithering, each 2x2 block holds one sample of every channel
+                            const auto& dither = *logDither;
+                            const int ditherIndex = ((y / 2) & DITHER_MASK) * DITHER_SIZE + ((x / 2) & DITHER_MASK);
+
+                            // Scale by dstWhiteLevel to match what the linearization table expects
+                            for (int i = 0; i < 4; i++)
+                                p[i] = logLevel(s[i], linear[i], srcBlackLevel[i], shadingMapVals[i], dstWhiteLevel) + dither[i][ditherIndex];
+                        }            
+                
+                        for (int i = 0; i < 4; i++)
+                            s[i] = storeLevel(p[i], dstBlackLevel[i], storedMaxLevel, codeShift);
+                    }
+
+                    // Write the 2x2 Bayer block
+                    rows[0].put(s[0]);
+                    rows[0].put(s[1]);
+                    rows[1].put(s[2]);
+                    rows[1].put(s[3]);
+                } else {
+                    std::array<uint16_t, 16> s = {                
+                        srcData[srcY * originalWidth + srcX], srcData[srcY * originalWidth + srcX + 1], srcData[(srcY + 1) * originalWidth + srcX], srcData[(srcY + 1) * originalWidth + srcX + 1],
+                        srcData[srcY * originalWidth + srcX + 2], srcData[srcY * originalWidth + srcX + 3], srcData[(srcY + 1) * originalWidth + srcX + 2], srcData[(srcY + 1) * originalWidth + srcX + 3],
+                        srcData[(srcY + 2) * originalWidth + srcX], srcData[(srcY + 2) * originalWidth + srcX + 1], srcData[(srcY + 3) * originalWidth + srcX], srcData[(srcY + 3) * originalWidth + srcX + 1],
+                        srcData[(srcY + 2) * originalWidth + srcX + 2], srcData[(srcY + 2) * originalWidth + srcX + 3], srcData[(srcY + 3) * originalWidth + srcX + 2], srcData[(srcY + 3) * originalWidth + srcX + 3]
+                    };
+
+                    if constexpr (Shading) {
+                        // Calculate position in shading map     
+                        shadingMapVals[0] = getShadingMapValue((srcX + left) * shadingMapScaleX, (srcY + top) * shadingMapScaleY, 0, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[1] = getShadingMapValue((srcX + left + 1) * shadingMapScaleX, (srcY + top) * shadingMapScaleY, 0, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[2] = getShadingMapValue((srcX + left) * shadingMapScaleX, (srcY + top + 1) * shadingMapScaleY, 0, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[3] = getShadingMapValue((srcX + left + 1) * shadingMapScaleX, (srcY + top + 1) * shadingMapScaleY, 0, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[4] = getShadingMapValue((srcX + left + cfaSize * 2) * shadingMapScaleX, (srcY + top) * shadingMapScaleY, 1, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[5] = getShadingMapValue((srcX + left + cfaSize * 2 + 1) * shadingMapScaleX, (srcY + top) * shadingMapScaleY, 1, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[6] = getShadingMapValue((srcX + left + cfaSize * 2) * shadingMapScaleX, (srcY + top + 1) * shadingMapScaleY, 1, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[7] = getShadingMapValue((srcX + left + cfaSize * 2 + 1) * shadingMapScaleX, (srcY + top + 1) * shadingMapScaleY, 1, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[8] = getShadingMapValue((srcX + left) * shadingMapScaleX, (srcY + top + cfaSize * 2) * shadingMapScaleY, 2, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[9] = getShadingMapValue((srcX + left + 1) * shadingMapScaleX, (srcY + top + cfaSize * 2) * shadingMapScaleY, 2, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[10] = getShadingMapValue((srcX + left) * shadingMapScaleX, (srcY + top + cfaSize * 2 + 1) * shadingMapScaleY, 2, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[11] = getShadingMapValue((srcX + left + 1) * shadingMapScaleX, (srcY + top + cfaSize * 2 + 1) * shadingMapScaleY, 2, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[12] = getShadingMapValue((srcX + left + cfaSize * 2) * shadingMapScaleX, (srcY + top + cfaSize * 2) * shadingMapScaleY, 3, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[13] = getShadingMapValue((srcX + left + cfaSize * 2 + 1) * shadingMapScaleX, (srcY + top + cfaSize * 2) * shadingMapScaleY, 3, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[14] = getShadingMapValue((srcX + left + cfaSize * 2) * shadingMapScaleX, (srcY + top + cfaSize * 2 + 1) * shadingMapScaleY, 3, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+                        shadingMapVals[15] = getShadingMapValue((srcX + left + cfaSize * 2 + 1) * shadingMapScaleX, (srcY + top + cfaSize * 2 + 1) * shadingMapScaleY, 3, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
                     }
-                }            
 
-                for (int i = 0; i < 16; i++)
-                    s[i] = std::clamp(std::round((p[i] + dstBlackLevel[i%4])), 0.f, dstWhiteLevel);
+                    std::array<float, 16> p;
+
+                    for (int i = 0; i < 16; i++)
+                        p[i] = linear[i%4] * (s[i] - srcBlackLevel[i%4]) * shadingMapVals[i];
+
+
+
+                    if constexpr (Transform == KernelTransform::Linear) {               // Linearize and (maybe) apply shading map
+                        for (int i = 0; i < 16; i++)
+                            p[i] = std::max(0.0f, p[i] * (dstWhiteLevel - dstBlackLevel[i%4]));
+                    } else {                                
+                        // Apply logarithmic tone mapping with blue noise dithering. Each channel is a 2x2 group of the 4x4 block,
+                        // a block covers 2x2 cells of the channel lattice.
+                        const auto& dither = *logDither;
+
+                        for (int i = 0; i < 16; i++) {
+                            const int ditherX = (x / 2 + (i & 1)) & DITHER_MASK;
+                            const int ditherY = (y / 2 + ((i >> 1) & 1)) & DITHER_MASK;
+
+                            // Apply log2 transform that preserves black and white levels as identity points
+                            float logValue = std::log2(1.0f + 60.0f * std::max(0.0f, p[i])) / std::log2(61.0f);                  
+                            p[i] = (logValue) * dstWhiteLevel + dither[i / 4][ditherY * DITHER_SIZE + ditherX]; // Scale by dstWhiteLevel to match what the linearization table expects
+                        }
+                    }            
+
+                    for (int i = 0; i < 16; i++)
+                        s[i] = static_cast<uint16_t>(std::clamp(std::round((p[i] + dstBlackLevel[i%4])), 0.f, storedMaxLevel)) >> codeShift;
                     
-                dstData[dstOffset]                      = static_cast<unsigned short>(s[0]); 
-                dstData[dstOffset + 1]                  = static_cast<unsigned short>(s[1]);
-                dstData[dstOffset + newWidth]           = static_cast<unsigned short>(s[2]);
-                dstData[dstOffset + newWidth + 1]       = static_cast<unsigned short>(s[3]);
-                dstData[dstOffset + 2]                  = static_cast<unsigned short>(s[4]); 
-                dstData[dstOffset + 3]                  = static_cast<unsigned short>(s[5]);
-                dstData[dstOffset + newWidth + 2]       = static_cast<unsigned short>(s[6]);
-                dstData[dstOffset + newWidth + 3]       = static_cast<unsigned short>(s[7]);
-                dstData[dstOffset + newWidth * 2]       = static_cast<unsigned short>(s[8]); 
-                dstData[dstOffset + newWidth * 2 + 1]   = static_cast<unsigned short>(s[9]);
-                dstData[dstOffset + newWidth * 3]       = static_cast<unsigned short>(s[10]);
-                dstData[dstOffset + newWidth * 3 + 1]   = static_cast<unsigned short>(s[11]);
-                dstData[dstOffset + newWidth * 2 + 2]   = static_cast<unsigned short>(s[12]); 
-                dstData[dstOffset + newWidth * 2 + 3]   = static_cast<unsigned short>(s[13]);
-                dstData[dstOffset + newWidth * 3 + 2]   = static_cast<unsigned short>(s[14]);
-                dstData[dstOffset + newWidth * 3 + 3]   = static_cast<unsigned short>(s[15]);
-                              
-                dstOffset += 2 * cfaSize;
-            }            
+                    rows[0].put(s[0]);
+                    rows[0].put(s[1]);
+                    rows[0].put(s[4]);
+                    rows[0].put(s[5]);
+                    rows[1].put(s[2]);
+                    rows[1].put(s[3]);
+                    rows[1].put(s[6]);
+                    rows[1].put(s[7]);
+                    rows[2].put(s[8]);
+                    rows[2].put(s[9]);
+                    rows[2].put(s[12]);
+                    rows[2].put(s[13]);
+                    rows[3].put(s[10]);
+                    rows[3].put(s[11]);
+                    rows[3].put(s[14]);
+                    rows[3].put(s[15]);
+                }            
+            }
         }
-        dstOffset += newWidth * (cfaSize == 2 && scale == 1 ? 3 : 1);
-    }
+    };
+
+    const uint32_t rowGroups = (newHeight + rowStep - 1) / rowStep;
+    const uint32_t numBands = pool ? (std::min)(rowGroups, static_cast<uint32_t>(pool->get_thread_count()) * 4) : 1;
+
+    // Select the kernel once for the frame
+    std::function<void(uint32_t, uint32_t)> kernel;
+
+    const KernelLayout kernelLayout = (transform == KernelTransform::DebugShading ? KernelLayout::Bayer : layout);
+
+    withConstant<unsigned short, 2, 4, 6, 8, 10, 12, 14, 16>(bits, [&](auto bitsTag) {
+        withConstant<bool, false, true>(applyShadingMap, [&](auto shadingTag) {
+            withConstant<KernelLayout, KernelLayout::Bayer, KernelLayout::QuadBayerBinned, KernelLayout::QuadBayerRemosaic, KernelLayout::QuadBayer>(kernelLayout, [&](auto layoutTag) {
+                withConstant<KernelTransform, KernelTransform::Linear, KernelTransform::Log, KernelTransform::DebugShading,
+                             KernelTransform::LinearFixed, KernelTransform::LogFixed>(transform, [&](auto transformTag) {
+                    if constexpr (hasKernel(std::decay_t<decltype(shadingTag)>::value, std::decay_t<decltype(layoutTag)>::value, std::decay_t<decltype(transformTag)>::value)) {
+                        kernel = [&processRows, bitsTag, shadingTag, layoutTag, transformTag](uint32_t yBegin, uint32_t yEnd) {
+                            processRows(bitsTag, shadingTag, layoutTag, transformTag, yBegin, yEnd);
+                        };
+                    }
+                });
+            });
+        });
+    });
+
+    parallelFor(pool, numBands, [&](size_t band) {
+        const uint32_t yBegin = rowStep * static_cast<uint32_t>(rowGroups * band / numBands);
+        const uint32_t yEnd = (std::min)(newHeight, rowStep * static_cast<uint32_t>(rowGroups * (band + 1) / numBands));
+
+        kernel(yBegin, yEnd);
+    });
+
+    if (payloadKey)
+        plan.storePayload(*payloadKey, dst);
 
     // Update dimensions
     inOutWidth = newWidth;
     inOutHeight = newHeight;
 
-    std::array<unsigned short, 4> blackLevelResult;
-
-    for(auto i = 0; i < dstBlackLevel.size(); ++i)
-        blackLevelResult[i] = static_cast<unsigned short>(std::round(dstBlackLevel[i]));
+    return std::make_tuple(std::move(dst), blackLevelResult, static_cast<unsigned short>(dstWhiteLevel), storedWhiteLevel,
+                           static_cast<unsigned short>(codeShift), std::move(opcodeList2));
+}
 
-    return std::make_tuple(dst, blackLevelResult, static_cast<unsigned short>(dstWhiteLevel), opcodeList2);
+bool isFrameIndependent(const RenderPlan& plan, const CameraFrameMetadata& metadata) {
+    // Debug output of the quad bayer kernel still uses the frame
+    return plan.kernels[metadata.needRemosaic || plan.interpretAsQuadBayer].transform == KernelTransform::DebugShading;
 }
 
 std::shared_ptr<std::vector<char>> generateDng(
     std::vector<uint8_t>& data,
     const CameraFrameMetadata& metadata,
-    const CameraConfiguration& cameraConfiguration,
-    float recordingFps,
+    const RenderPlan& plan,
     int frameNumber,
-    double baselineExpValue,
-    const RenderSettings& settings)
+    BS::thread_pool* pool)
 {
     Measure m("generateDng");
 
+    const auto& cameraConfiguration = *plan.cameraConfiguration;
+    const float recordingFps = plan.recordingFps;
+
     unsigned int width = metadata.width;
     unsigned int height = metadata.height;
 
-    std::array<uint8_t, 4> cfa;
-    std::array<uint8_t, 16> qcfa;
-
-    if(cameraConfiguration.sensorArrangement == "rggb")
-        cfa = { 0, 1, 1, 2 };
-    else if(cameraConfiguration.sensorArrangement == "bggr")
-        cfa = { 2, 1, 1, 0 };
-    else if(cameraConfiguration.sensorArrangement == "grbg")
-        cfa = { 1, 0, 2, 1 };
-    else if(cameraConfiguration.sensorArrangement == "gbrg")
-        cfa = { 1, 2, 0, 1 };
-    else
-        throw std::runtime_error("Invalid sensor arrangement");
-
-    // Scale down if requested
-    bool applyShadingMap = settings.options & RENDER_OPT_APPLY_VIGNETTE_CORRECTION;
-    bool vignetteOnlyColor = settings.options & RENDER_OPT_VIGNETTE_ONLY_COLOR;
-    bool normalizeShadingMap = settings.options & RENDER_OPT_NORMALIZE_SHADING_MAP;
-    bool debugShadingMap = settings.options & RENDER_OPT_DEBUG_SHADING_MAP;
-    bool normalizeExposure = settings.options & RENDER_OPT_NORMALIZE_EXPOSURE;
-    bool useLogCurve = settings.options & RENDER_OPT_LOG_TRANSFORM;
-    bool interpretAsQuadBayer = metadata.needRemosaic || settings.options & RENDER_OPT_INTERPRET_AS_QUAD_BAYER;
-
-    std::string cropTarget = settings.cropTarget;
-    if(!(settings.options & RENDER_OPT_CROPPING))// || width != metadata.originalWidth || height != metadata.originalHeight)
-        cropTarget = "0x0";
-
-    auto [processedData, dstBlackLevel, dstWhiteLevel, opcodeList2] = utils::preprocessData(
+    const bool interpretAsQuadBayer = metadata.needRemosaic || plan.interpretAsQuadBayer;
+
+    auto [processedData, dstBlackLevel, dstWhiteLevel, storedWhiteLevel, codeShift, opcodeList2] = utils::preprocessData(
         data,
         width, height,
         metadata,
-        cameraConfiguration,
-        cfa,
-        settings.draftScale,
-        applyShadingMap, vignetteOnlyColor, normalizeShadingMap, debugShadingMap, interpretAsQuadBayer,
-        cropTarget,
-        settings.levels,
-        settings.logTransform,
-        settings.quadBayerOption,
-        true  // includeOpcode = true to generate lens shading opcode when not applied to image
+        plan,
+        interpretAsQuadBayer,
+        true, // includeOpcode = true to generate lens shading opcode when not applied to image
+        pool
     );
 
     spdlog::debug("New black level {},{},{},{} and white level {}",
                   dstBlackLevel[0], dstBlackLevel[1], dstBlackLevel[2], dstBlackLevel[3], dstWhiteLevel);
 
-    // Encode to reduce size in container
-    auto encodeBits = bitsNeeded(dstWhiteLevel);
-
-    if(encodeBits <= 2) {
-        utils::encodeTo2Bit(processedData, width, height);
-        encodeBits = 2;
-    }
-    else if(encodeBits <= 4) {
-        utils::encodeTo4Bit(processedData, width, height);
-        encodeBits = 4;
-    }
-    else if(encodeBits <= 6) {
-        utils::encodeTo6Bit(processedData, width, height);
-        encodeBits = 6;
-    }
-    else if(encodeBits <= 8) {
-        utils::encodeTo8Bit(processedData, width, height);
-        encodeBits = 8;
-    }
-    else if(encodeBits <= 10) {
-        utils::encodeTo10Bit(processedData, width, height);
-        encodeBits = 10;
-    }
-    else if(encodeBits <= 12) {
-        utils::encodeTo12Bit(processedData, width, height);
-        encodeBits = 12;
-    }
-    else if(encodeBits <= 14) {
-        utils::encodeTo14Bit(processedData, width, height);
-        encodeBits = 14;
-    }
-    else {
-        encodeBits = 16;
-    }
+    // Data is already packed to this depth
+    const unsigned short encodeBits = packedBits(storedWhiteLevel);
 
     // Create first frame
     tinydngwriter::DNGImage dng;
@@ -1157,7 +1174,7 @@ std::shared_ptr<std::vector<char>> generateDng(
     dng.SetBigEndian(false);
     dng.SetDNGVersion(1, 4, 0, 0);
     dng.SetDNGBackwardVersion(1, 1, 0, 0);
-    dng.SetImageData(reinterpret_cast<const unsigned char*>(processedData.data()), processedData.size());
+    dng.SetImageData(reinterpret_cast<const unsigned char*>(processedData->data()), processedData->size());
     dng.SetImageWidth(width);
     dng.SetImageLength(height);
     dng.SetPlanarConfig(tinydngwriter::PLANARCONFIG_CONTIG);
@@ -1174,40 +1191,17 @@ std::shared_ptr<std::vector<char>> generateDng(
     dng.SetIso(metadata.iso);
     dng.SetExposureTime(metadata.exposureTime / 1e9);
 
-    float exposureOffset = (settings.cameraModel == "Panasonic" ? -2.0f : 0.0f);
-
-    // Parse float from exposureCompensation string and add to exposureOffset
-    if (!settings.exposureCompensation.empty()) {
-        try {
-            exposureOffset += std::stof(settings.exposureCompensation);
-        } catch (const std::exception&) {
-            // If parsing fails, keep the original exposureOffset value
-        }
-    }
-
-    if (normalizeExposure)
-        dng.SetBaselineExposure(std::log2(baselineExpValue / (metadata.iso * metadata.exposureTime)) + exposureOffset);
+    if (plan.normalizeExposure)
+        dng.SetBaselineExposure(std::log2(plan.baselineExpValue / (metadata.iso * metadata.exposureTime)) + plan.exposureOffset);
     else
-        dng.SetBaselineExposure(exposureOffset);
+        dng.SetBaselineExposure(plan.exposureOffset);
 
-    if(interpretAsQuadBayer && settings.draftScale == 1 && settings.quadBayerOption == QuadBayerMode::CorrectQBCFAMetadata) {   //de/remosaic need to be disabled and add ui option. 
+    if(interpretAsQuadBayer && plan.quadCfaTags) {
         dng.SetCFARepeatPatternDim(4, 4);
-        std::array<uint8_t, 4> cfa_pattern_0112 = {0,1,1,2};
-        std::array<uint8_t, 4> cfa_pattern_2110 = {2,1,1,0};
-        std::array<uint8_t, 4> cfa_pattern_1021 = {1,0,2,1};
-        
-        if (cfa == cfa_pattern_0112) 
-            qcfa = {0,0,1,1,0,0,1,1,1,1,2,2,1,1,2,2};
-        else if (cfa == cfa_pattern_2110) 
-            qcfa = {2,2,1,1,2,2,1,1,1,1,0,0,1,1,0,0};
-        else if (cfa == cfa_pattern_1021) 
-            qcfa = {1,1,0,0,1,1,0,0,2,2,1,1,2,2,1,1};
-        else 
-            qcfa = {1,1,2,2,1,1,2,2,0,0,1,1,0,0,1,1};
-        dng.SetCFAPattern(16, qcfa.data());
+        dng.SetCFAPattern(16, plan.quadCfa.data());
     } else {
         dng.SetCFARepeatPatternDim(2, 2);
-        dng.SetCFAPattern(4, cfa.data());
+        dng.SetCFAPattern(4, plan.cfa.data());
     }
 
     // Add orientation tag
@@ -1278,8 +1272,8 @@ std::shared_ptr<std::vector<char>> generateDng(
 
     dng.SetAsShotNeutral(3, metadata.asShotNeutral.data());
 
-    dng.SetCalibrationIlluminant1(getColorIlluminant(cameraConfiguration.colorIlluminant1));
-    dng.SetCalibrationIlluminant2(getColorIlluminant(cameraConfiguration.colorIlluminant2));
+    dng.SetCalibrationIlluminant1(plan.calibrationIlluminant1);
+    dng.SetCalibrationIlluminant2(plan.calibrationIlluminant2);
 
     // Additional information
     const auto software = "MotionCam Tools";
@@ -1287,26 +1281,15 @@ std::shared_ptr<std::vector<char>> generateDng(
     dng.SetSoftware(software);
 
 
-    if(settings.cameraModel != ""){
-        if (settings.cameraModel == "Blackmagic") {
-            dng.SetUniqueCameraModel("Blackmagic Pocket Cinema Camera 4K");
-        } else if (settings.cameraModel == "Panasonic") {
-            dng.SetUniqueCameraModel("Panasonic Varicam RAW");
-        } else if (settings.cameraModel == "Fujifilm" || settings.cameraModel == "Fujifilm X-T5") {
-            dng.SetUniqueCameraModel("Fujifilm X-T5");
-            dng.SetMake("Fujifilm");
-            dng.SetCameraModelName("X-T5");
-        } else {
-            // Generic camera model
-            dng.SetUniqueCameraModel(settings.cameraModel);
-        }
-    } else {
-        dng.SetUniqueCameraModel(cameraConfiguration.extraData.postProcessSettings.metadata.buildModel);
-    }
+    dng.SetUniqueCameraModel(plan.uniqueCameraModel);
+    if (!plan.make.empty())
+        dng.SetMake(plan.make);
+    if (!plan.cameraModelName.empty())
+        dng.SetCameraModelName(plan.cameraModelName);
 
     // Add lens shading map as opcode list 2 if not applied to image data
-    if (!opcodeList2.IsEmpty()) {
-        dng.SetOpcodeList2(opcodeList2);
+    if (opcodeList2 && !opcodeList2->IsEmpty()) {
+        dng.SetOpcodeList2(*opcodeList2);
     }
 
 
@@ -1318,40 +1301,23 @@ std::shared_ptr<std::vector<char>> generateDng(
 
     // Add linearization table based on actual bit depth
 
-    if (settings.logTransform != LogTransformMode::Disabled && !(settings.logTransform == LogTransformMode::KeepInput && !applyShadingMap)) {
-        // Create linearization table sized for the actual stored range
-        // The stored values range from 0 to dstWhiteLevel, so we need dstWhiteLevel+1 entries
-        const int tableSize = static_cast<int>(dstWhiteLevel) + 1;
-        std::vector<unsigned short> linearizationTable(tableSize);
-        
-        for (int i = 0; i < tableSize; i++) {
-            // Convert stored log value back to linear
-            // Must match the aggressive log curve: logValue = log2(1 + k*clampedValue) / log2(1 + k)
-            // Inverse: clampedValue = (2^(logValue * log2(1 + k)) - 1) / k
-            
-            float logValue = static_cast<float>(i);
-            float normalizedLogValue = logValue / dstWhiteLevel;  // Normalize by dstWhiteLevel to match forward transform
-            
-            // Reverse the k=30 curve with guaranteed identity preservation
-            float linearValue;
-            
-            if (i == 0) {
-                linearValue = 0.0f;  // Exact identity: stored 0 → linear 0
-            } else if (i == tableSize - 1) {
-                linearValue = 1.0f;  // Force maximum table entry → linear 1 → 65535
-            } else {                               
-                // Inverse of: logValue = log2(1 + k*clampedValue) / log2(1 + k)
-                linearValue = (std::pow(2.0f, normalizedLogValue * std::log2(1.0f + 60.0f)) - 1.0f) / 60.0f;
-                linearValue = std::clamp(linearValue, 0.0f, 1.0f);
-            }            
-            // Scale to 16-bit range            
-            linearizationTable[i] = static_cast<unsigned short>(linearValue * 65535.0f);                  
-        }        
-        dng.SetLinearizationTable(tableSize, linearizationTable.data());
+    if (plan.logLinearization) {
+        // Maps stored log values back to linear, the table is shared by all frames with this white level
+        const auto& linearizationTable = plan.logLinearizationTable(dstWhiteLevel);
+        dng.SetLinearizationTable(static_cast<int>(linearizationTable.size()), linearizationTable.data());
         std::array<unsigned short, 4> linearBlackLevel = {0, 0, 0, 0};  // Linear black is 0
         dng.SetBlackLevel(4, linearBlackLevel.data());
         dng.SetWhiteLevel(65534);  //idk why
         //displayLevels = std::to_string(static_cast<int>(srcWhiteLevel)) + "/" + std::to_string(static_cast<float>(srcBlackLevel[0])) + " -> " + std::to_string(static_cast<int>(dstWhiteLevel)) + "/0 RAW" + std::to_string(bitsNeeded(dstWhiteLevel)) + " (log)";
+    } else if (storedWhiteLevel != dstWhiteLevel) {
+        // Stored codes are shifted down and limited to the range of the clip, levels stay in source codes
+        std::vector<unsigned short> linearizationTable(storedWhiteLevel + 1);
+        for (size_t i = 0; i < linearizationTable.size(); i++)
+            linearizationTable[i] = static_cast<unsigned short>(i << codeShift);
+
+        dng.SetLinearizationTable(static_cast<int>(linearizationTable.size()), linearizationTable.data());
+        dng.SetBlackLevel(4, dstBlackLevel.data());
+        dng.SetWhiteLevel(dstWhiteLevel);
     } else {           
         dng.SetBlackLevel(4, dstBlackLevel.data());
         dng.SetWhiteLevel(dstWhiteLevel);
@@ -1380,6 +1346,64 @@ std::shared_ptr<std::vector<char>> generateDng(
     return output;
 }
 
+void parallelFor(BS::thread_pool* pool, size_t count, const std::function<void(size_t)>& fn) {
+    if(!pool || count < 2 || pool->get_thread_count() < 2) {
+        for(size_t i = 0; i < count; i++)
+            fn(i);
+        return;
+    }
+
+    struct State {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    auto state = std::make_shared<State>();
+
+    // fn is only called for claimed items, so helpers that start after everything is done never touch it.
+    // After a failure the remaining items are still claimed and counted, just not run.
+    auto run = [state, count, &fn]() {
+        size_t i;
+
+        while((i = state->next.fetch_add(1)) < count) {
+            if(!state->failed) {
+                try {
+                    fn(i);
+                }
+                catch(...) {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if(!state->error)
+                        state->error = std::current_exception();
+                    state->failed = true;
+                }
+            }
+
+            if(state->done.fetch_add(1) + 1 == count) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->cv.notify_all();
+            }
+        }
+    };
+
+    const size_t helpers = (std::min)(count, static_cast<size_t>(pool->get_thread_count())) - 1;
+    for(size_t i = 0; i < helpers; i++)
+        pool->detach_task(run);
+
+    // The caller works too, so this can't deadlock when called from a pool thread
+    run();
+
+    // Helpers reference fn and the caller's stack, so wait for them before rethrowing
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait(lock, [&]() { return state->done.load() == count; });
+
+    if(state->error)
+        std::rethrow_exception(state->error);
+}
+
 int gcd(int a, int b) {
     while (b != 0) {
         int temp = b;
@@ -4,6 +4,12 @@
 #include "Utils.h"
 #include "AudioWriter.h"
 #include "LRUCache.h"
+#include "MappedFile.h"
+#include "IoScheduler.h"
+#include "BufferPool.h"
+#include "RenderPlan.h"
+#include "RenderBudget.h"
+#include "MemoryGovernor.h"
 
 #include <motioncam/Decoder.hpp>
 
@@ -16,11 +22,18 @@
 #include <audiofile/AudioFile.h>
 
 #include <algorithm>
+#include <cstring>
+#include <future>
 #include <sstream>
 #include <tuple>
 
 namespace motioncam {
 
+constexpr auto MIN_READAHEAD_FRAMES = 8;
+constexpr auto MAX_READAHEAD_FRAMES = 64;
+constexpr size_t CODE_RANGE_SAMPLE_FRAMES = 5;
+constexpr size_t RENDER_STATS_LOG_FRAMES = 500; // Render stats are logged every this many decoded frames
+
 namespace {
 
 #ifdef _WIN32
@@ -212,6 +225,64 @@ IconSize=16
         }
     }
 
+    // Byte range of every frame, in the order of the sorted timestamps. Read from the buffer index at the end of
+    // the container: an index item, then { magic, count, offset of the entries }, the entries being
+    // { frame offset, timestamp } pairs. Returns nothing unless the index lists exactly the decoder's frames.
+    std::vector<std::pair<size_t, size_t>> readFrameRanges(const MappedFile& file, const std::vector<Timestamp>& frames) {
+#pragma pack(push, 1)
+        struct IndexItem { uint8_t type; uint32_t size; };
+        struct BufferIndex { int32_t magicNumber; int32_t numOffsets; int64_t indexDataOffset; };
+        struct BufferOffset { int64_t offset; int64_t timestamp; };
+#pragma pack(pop)
+
+        const size_t tailSize = sizeof(IndexItem) + sizeof(BufferIndex);
+        if(!file.isValid() || file.size() < tailSize || frames.empty())
+            return {};
+
+        IndexItem item;
+        BufferIndex index;
+
+        std::memcpy(&item, file.data() + file.size() - tailSize, sizeof(item));
+        std::memcpy(&index, file.data() + file.size() - sizeof(index), sizeof(index));
+
+        const size_t indexEnd = file.size() - tailSize;
+
+        if(item.size != sizeof(BufferIndex) ||
+           index.numOffsets != static_cast<int64_t>(frames.size()) ||
+           index.indexDataOffset < 0 ||
+           static_cast<size_t>(index.indexDataOffset) > indexEnd ||
+           frames.size() * sizeof(BufferOffset) > indexEnd - static_cast<size_t>(index.indexDataOffset))
+        {
+            return {};
+        }
+
+        std::vector<BufferOffset> offsets(frames.size());
+        std::memcpy(offsets.data(), file.data() + index.indexDataOffset, offsets.size() * sizeof(BufferOffset));
+
+        // A frame ends where the next one in the file starts, the last one at the index
+        std::sort(offsets.begin(), offsets.end(), [](const auto& a, const auto& b) { return a.offset < b.offset; });
+
+        std::vector<std::pair<size_t, size_t>> ranges(frames.size(), { 0, 0 });
+        std::vector<bool> found(frames.size(), false);
+
+        for(size_t i = 0; i < offsets.size(); i++) {
+            const int64_t end = i + 1 < offsets.size() ? offsets[i + 1].offset : index.indexDataOffset;
+
+            auto it = std::lower_bound(frames.begin(), frames.end(), offsets[i].timestamp);
+            if(it == frames.end() || *it != offsets[i].timestamp || offsets[i].offset < 0 || end < offsets[i].offset)
+                return {};
+
+            const size_t frameIndex = std::distance(frames.begin(), it);
+            if(found[frameIndex])
+                return {};
+
+            found[frameIndex] = true;
+            ranges[frameIndex] = { static_cast<size_t>(offsets[i].offset), static_cast<size_t>(end) };
+        }
+
+        return ranges;
+    }
+
     int getScaleFromOptions(FileRenderOptions options, int draftScale) {
         if(options & RENDER_OPT_DRAFT)
             return draftScale;
@@ -224,15 +295,31 @@ VirtualFileSystemImpl_MCRAW::VirtualFileSystemImpl_MCRAW(
         BS::thread_pool& ioThreadPool,
         BS::thread_pool& processingThreadPool,
         LRUCache& lruCache,
+        RenderBudget& renderBudget,
+        MemoryGovernor& memoryGovernor,
         const RenderSettings& settings,
         const std::string& file,
         const std::string& baseName) :
         mCache(lruCache),
+        mRenderBudget(renderBudget),
+        mMemoryGovernor(memoryGovernor),
         mIoThreadPool(ioThreadPool),
         mProcessingThreadPool(processingThreadPool),
+        mIoScheduler(std::make_unique<IoScheduler>(ioThreadPool)),
+        mBufferPool(std::make_shared<BufferPool>(ioThreadPool.get_thread_count())),
         mSrcPath(file),
         mBaseName(baseName),
         mTypicalDngSize(0),
+        mFrameRenderBytes(0),
+        mStaticBytes(0),
+        mReadaheadStart(0),
+        mReadaheadEnd(0),
+        mReadaheadWindow(MIN_READAHEAD_FRAMES),
+        mActiveTasks(0),
+        mClosing(false),
+        mDecodedFrames(0),
+        mSkippedFrames(0),
+        mWastedFrames(0),
         mFps(0),
         mMedFps(0),
         mAvgFps(0),
@@ -250,12 +337,18 @@ VirtualFileSystemImpl_MCRAW::VirtualFileSystemImpl_MCRAW(
         mExposureCompensation(settings.exposureCompensation),
         mQuadBayerOption(settings.quadBayerOption),
         mOptions(settings.options) {
-    
+
+    mMappedFile = std::make_unique<MappedFile>(mSrcPath);
+
     Decoder decoder(mSrcPath);
     auto frames = decoder.getFrames();
     std::sort(frames.begin(), frames.end());
     if(frames.empty())
         return;
+
+    mFrameRanges = readFrameRanges(*mMappedFile, frames);
+    if(mFrameRanges.empty())
+        spdlog::warn("No usable frame index in {}, readahead estimates frame offsets", mSrcPath);
     mBaselineExpValue = std::numeric_limits<double>::max();
     for(const auto& frame : frames) {
         nlohmann::json metadata;
@@ -264,10 +357,40 @@ VirtualFileSystemImpl_MCRAW::VirtualFileSystemImpl_MCRAW(
         mBaselineExpValue = std::min(mBaselineExpValue, cameraFrameMetadata.iso * cameraFrameMetadata.exposureTime);
     }
     this->init(mOptions);
+
+    mMemoryGovernor.addMount(this, [this]() { return residentBytes(); });
 }
 
 VirtualFileSystemImpl_MCRAW::~VirtualFileSystemImpl_MCRAW() {
     spdlog::info("Destroying VirtualFileSystemImpl_MCRAW({})", mSrcPath);
+
+    // Loads waiting for the render budget are not queued again
+    mClosing = true;
+
+    // Loads that have not started are dropped, the ones running and their renders still use this file
+    mIoScheduler->cancel();
+    waitForTasks();
+
+    // Nothing is left to answer the reads of dropped loads
+    std::vector<Entry> unanswered;
+
+    {
+        std::lock_guard<std::mutex> lock(mPendingReadsMutex);
+
+        for(const auto& [entry, reads] : mPendingReads)
+            unanswered.push_back(entry);
+    }
+
+    // The shared cache would otherwise keep them in progress and a later mount of the clip would wait on them
+    for(const auto& entry : unanswered) {
+        mCache.markLoadFailed(entry);
+        completeReads(entry, nullptr);
+    }
+
+    // Renders are done, nothing puts entries owned by this file any more
+    mMemoryGovernor.removeMount(this);
+
+    logRenderStats();
 }
 
 void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
@@ -283,6 +406,40 @@ void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
     // Clear everything
     mFiles.clear();
 
+    // The frames of a clip never change. Renders and prefetches read them while options are updated, so they
+    // are only set by the first init.
+    if(mFrames.empty())
+        mFrames = frames;
+
+    {
+        std::lock_guard<std::mutex> lock(mReadaheadMutex);
+
+        mReadaheadStart = mReadaheadEnd = 0;
+        mReadaheadWindow = MIN_READAHEAD_FRAMES;
+    }
+
+    // The code range does not depend on the settings, frames spread over the clip are measured once. The
+    // samples are decoded on the IO pool while the first frame is rendered here.
+    std::vector<std::future<CodeRange>> codeRangeSamples;
+
+    if((options & RENDER_OPT_ADAPTIVE_BIT_DEPTH) && !mCodeRange) {
+        for(size_t i = 1; i < CODE_RANGE_SAMPLE_FRAMES && i < frames.size(); i++) {
+            const auto timestamp = frames[i * (frames.size() - 1) / (CODE_RANGE_SAMPLE_FRAMES - 1)];
+
+            codeRangeSamples.push_back(mIoThreadPool.submit_task([srcPath = mSrcPath, timestamp]() {
+                Decoder sampleDecoder(srcPath);
+                std::vector<uint8_t> sampleData;
+                nlohmann::json sampleMetadata;
+                CodeRange sampleRange;
+
+                sampleDecoder.loadFrame(timestamp, sampleData, sampleMetadata);
+                sampleRange.add(reinterpret_cast<const uint16_t*>(sampleData.data()), sampleData.size() / sizeof(uint16_t));
+
+                return sampleRange;
+            }));
+        }
+    }
+
     auto frameRateInfo = calculateFrameRate(frames);
     mMedFps = frameRateInfo.medianFrameRate;
     mAvgFps = frameRateInfo.averageFrameRate;
@@ -373,7 +530,9 @@ void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
 
     decoder.loadFrame(frames[0], data, metadata);
 
-    auto cameraConfig = CameraConfiguration::parse(decoder.getContainerMetadata());
+    // Container metadata is the same for every frame, parse it once
+    auto cameraConfig = std::make_shared<const CameraConfiguration>(
+        CameraConfiguration::parse(decoder.getContainerMetadata()));
     auto cameraFrameMetadata = CameraFrameMetadata::parse(metadata);
 
     // Store frame information
@@ -395,18 +554,42 @@ void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
         mQuadBayerOption
     );
 
+    if((options & RENDER_OPT_ADAPTIVE_BIT_DEPTH) && !mCodeRange) {
+        auto codeRange = std::make_unique<CodeRange>();
+
+        codeRange->add(reinterpret_cast<const uint16_t*>(data.data()), data.size() / sizeof(uint16_t));
+
+        for(auto& sample : codeRangeSamples)
+            codeRange->add(sample.get());
+
+        spdlog::info("Measured code range of {} (max: {}, used bits: {:#x})", mSrcPath, codeRange->maxValue, codeRange->usedBits);
+        spdlog::warn("Adaptive bit depth is enabled for {}, frames outside of the range of {} sampled frames are clipped",
+                     mSrcPath, codeRangeSamples.size() + 1);
+
+        mCodeRange = std::move(codeRange);
+    }
+
+    // Settings are parsed once here, render tasks share the plan
+    auto renderPlan = RenderPlan::create(settingsForInit, cameraConfig, mFps, mBaselineExpValue, mCodeRange.get());
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRenderPlan = renderPlan;
+    }
+
     auto dngData = utils::generateDng(
         data,
         cameraFrameMetadata,
-        cameraConfig,
-        mFps,
+        *renderPlan,
         0,
-        mBaselineExpValue,
-        settingsForInit
+        &mProcessingThreadPool
     );
 
     mTypicalDngSize = dngData->size();
 
+    // A frame in flight holds its raw data and the DNG it renders to
+    mFrameRenderBytes = data.size() + mTypicalDngSize;
+
     // Generate file entries
     int lastPts = 0;
 
@@ -497,6 +680,18 @@ void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
             ++lastPts;
         }
     }
+
+    // Memory held until the file is unmounted, reported to the memory governor
+    size_t staticBytes = mAudioFile.capacity() + mFrames.capacity() * sizeof(int64_t) + mFiles.capacity() * sizeof(Entry);
+
+    for(const auto& file : mFiles) {
+        staticBytes += file.name.capacity();
+
+        for(const auto& part : file.pathParts)
+            staticBytes += sizeof(part) + part.capacity();
+    }
+
+    mStaticBytes = staticBytes;
 }
 
 std::vector<Entry> VirtualFileSystemImpl_MCRAW::listFiles(const std::string& filter) const {
@@ -519,9 +714,14 @@ size_t VirtualFileSystemImpl_MCRAW::generateFrame(
     const size_t len,
     void* dst,
     std::function<void(size_t, int)> result,
-    bool async)
+    bool async,
+    CancelToken cancelToken)
 {
-    using FrameData = std::tuple<size_t, CameraConfiguration, CameraFrameMetadata, std::shared_ptr<std::vector<uint8_t>>>;
+    using FrameData = std::tuple<size_t, CameraFrameMetadata, std::shared_ptr<std::vector<uint8_t>>>;
+
+    // Readers fetch a file in blocks, count it once for the cache policy
+    if(pos == 0)
+        mCache.recordAccess(entry);
 
     // Try to get from cache first
     auto cacheEntry = mCache.get(entry);
@@ -532,14 +732,71 @@ size_t VirtualFileSystemImpl_MCRAW::generateFrame(
         // Copy the data from cache
         std::memcpy(dst, cacheEntry->data() + pos, actualLen);
 
-        // Push entry to front
-        mCache.put(entry, cacheEntry);
+        // Push entry to front, it is added back under this file if it was evicted meanwhile
+        mCache.put(entry, cacheEntry, this);
 
         return actualLen;
     }
 
-    // Use IO thread pool to decode frame
-    auto frameDataFuture = mIoThreadPool.submit_task([entry, &srcPath = mSrcPath, &options = mOptions]() -> FrameData {
+    // Position of the frame in the file, frames are stored in capture order
+    auto frameIt = std::lower_bound(mFrames.begin(), mFrames.end(), std::get<Timestamp>(entry.userData));
+    const size_t filePosition = std::distance(mFrames.begin(), frameIt);
+
+    std::shared_ptr<const RenderPlan> renderPlan;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        renderPlan = mRenderPlan;
+    }
+
+    // Set when the caller waits for the read to finish
+    std::shared_ptr<std::promise<size_t>> completion;
+    std::future<size_t> completed;
+
+    if(!async) {
+        completion = std::make_shared<std::promise<size_t>>();
+        completed = completion->get_future();
+    }
+
+    // Reads of a frame that is already being rendered are answered by that render
+    bool rendering;
+
+    {
+        std::lock_guard<std::mutex> lock(mPendingReadsMutex);
+
+        auto& reads = mPendingReads[entry];
+        rendering = !reads.empty();
+
+        reads.push_back({ cancelToken, [pos, len, dst, result, completion](std::shared_ptr<std::vector<char>> dngData) {
+            size_t readBytes = 0;
+            int errorCode = -1;
+
+            if(dngData && pos < dngData->size()) {
+                // Calculate length to copy
+                const size_t actualLen = (std::min)(len, dngData->size() - pos);
+
+                std::memcpy(dst, dngData->data() + pos, actualLen);
+
+                readBytes = actualLen;
+                errorCode = 0;
+            }
+
+            result(readBytes, errorCode);
+
+            if(completion)
+                completion->set_value(readBytes);
+        }});
+    }
+
+    if(rendering)
+        return async ? 0 : completed.get();
+
+    // Debug shading output usually does not read the frame data
+    if(!renderPlan->debugShadingMap)
+        prefetchFrames(filePosition);
+
+    // Decoding runs on the IO thread pool, loads are issued in file order. Decoded frames are passed on to the
+    // render stage so processing threads never wait on the disk.
+    auto loadTask = [entry, &srcPath = mSrcPath, &options = mOptions, bufferPool = mBufferPool, renderPlan]() -> FrameData {
         thread_local std::map<std::string, std::unique_ptr<Decoder>> decoders;
 
         auto timestamp = std::get<Timestamp>(entry.userData);
@@ -551,10 +808,9 @@ size_t VirtualFileSystemImpl_MCRAW::generateFrame(
         }
 
         auto& decoder = decoders[srcPath];
-        auto data = std::make_shared<std::vector<uint8_t>>();
 
         nlohmann::json metadata;
-        auto allFrames = decoder->getFrames();
+        const auto& allFrames = decoder->getFrames();
 
         // Find the frame (index)
         auto it = std::find(allFrames.begin(), allFrames.end(), timestamp);
@@ -563,92 +819,259 @@ size_t VirtualFileSystemImpl_MCRAW::generateFrame(
             throw std::runtime_error("Failed to find frame");
         }
 
-        decoder->loadFrame(timestamp, *data, metadata);
-
         size_t frameIndex = std::distance(allFrames.begin(), it);
 
-        return std::make_tuple(
-            frameIndex, CameraConfiguration::parse(decoder->getContainerMetadata()), CameraFrameMetadata::parse(metadata), std::move(data));
-    });
+        // Skip decoding when the frame renders from its metadata alone
+        if(renderPlan->debugShadingMap) {
+            decoder->loadFrameMetadata(timestamp, metadata);
+
+            auto frameMetadata = CameraFrameMetadata::parse(metadata);
+            if(utils::isFrameIndependent(*renderPlan, frameMetadata))
+                return std::make_tuple(frameIndex, std::move(frameMetadata), std::make_shared<BufferPool::Buffer>());
+        }
+
+        // Reused buffer already has the frame size, so loading into it does not allocate
+        auto data = bufferPool->acquire();
+
+        decoder->loadFrame(timestamp, *data, metadata);
 
+        return std::make_tuple(frameIndex, CameraFrameMetadata::parse(metadata), std::move(data));
+    };
 
-    // Use processing thread pool to generate DNG
-    auto sharableFuture = frameDataFuture.share();
+    // Keeps the file system alive until the load and its render are done or the load is dropped
+    auto task = trackTask();
 
-    const auto fps = mFps;
-    const auto draftScale = mDraftScale;
-    const auto baselineExpValue = mBaselineExpValue;
-    const auto options = mOptions;
+    auto renderTask = [this, &cache = mCache, entry, renderPlan](FrameData decodedFrame) {
+        std::shared_ptr<std::vector<char>> dngData;
 
-    auto generateTask = [this, &cache = mCache, entry, sharableFuture, fps, draftScale, baselineExpValue, options, pos, len, dst, result]() {
-        size_t readBytes = 0;
-        int errorCode = -1;
+        if(dropAbandonedReads(entry)) {
+            ++mWastedFrames;
+            return;
+        }
 
         try {
-            auto decodedFrame = sharableFuture.get();
-            auto [frameIndex, containerMetadata, frameMetadata, frameData] = std::move(decodedFrame);
+            auto [frameIndex, frameMetadata, frameData] = std::move(decodedFrame);
 
             spdlog::debug("Generating {}", entry.name);
 
-            RenderSettings settings(
-                options,
-                draftScale,
-                mCFRTarget,
-                mCropTarget,
-                mCameraModel,
-                mLevels,
-                mLogTransform,
-                mExposureCompensation,
-                mQuadBayerOption
-            );
-
-            auto dngData = utils::generateDng(
+            dngData = utils::generateDng(
                 *frameData,
                 frameMetadata,
-                containerMetadata,
-                fps,
+                *renderPlan,
                 frameIndex,
-                baselineExpValue,
-                settings);
-
-            if(dngData && pos < dngData->size()) {
-                // Calculate length to copy
-                const size_t actualLen = std::min(len, dngData->size() - pos);
-
-                std::memcpy(dst, dngData->data() + pos, actualLen);
-
-                readBytes = actualLen;
-                errorCode = 0;
-            }
+                &mProcessingThreadPool);
 
             // Add to cache
-            cache.put(entry, dngData);
+            cache.put(entry, dngData, this);
         }
-        catch(std::runtime_error& e) {
+        catch(std::exception& e) {
             spdlog::error("Failed to generate DNG (error: {})", e.what());
             cache.markLoadFailed(entry);
         }
+        catch(...) {
+            spdlog::error("Failed to generate DNG (unknown error)");
+            cache.markLoadFailed(entry);
+        }
 
-        result(readBytes, errorCode);
-
-        return readBytes;
+        // Waiting reads are answered on every path, without data if the render failed. Everyone stopped waiting while the frame rendered, it stays in the cache for later reads
+        if(dropAbandonedReads(entry))
+            ++mWastedFrames;
+        else
+            completeReads(entry, dngData);
     };
 
+    // Loads wait for room in the render budget so a burst of reads cannot hold unbounded frame buffers
+    submitLoad(filePosition, mFrameRenderBytes, [this, &cache = mCache, entry, loadTask, renderTask, task](std::shared_ptr<void> reservation) {
+        // Waiting for the budget may take a while
+        if(dropAbandonedReads(entry)) {
+            ++mSkippedFrames;
+            return;
+        }
+
+        try {
+            auto decodedFrame = loadTask();
+
+            if(++mDecodedFrames % RENDER_STATS_LOG_FRAMES == 0)
+                logRenderStats();
+
+            mProcessingThreadPool.detach_task([renderTask, reservation, task, decodedFrame = std::move(decodedFrame)]() mutable {
+                renderTask(std::move(decodedFrame));
+                reservation.reset();
+            });
+        }
+        catch(std::exception& e) {
+            spdlog::error("Failed to load frame (error: {})", e.what());
+            cache.markLoadFailed(entry);
+
+            completeReads(entry, nullptr);
+        }
+        catch(...) {
+            spdlog::error("Failed to load frame (unknown error)");
+            cache.markLoadFailed(entry);
+
+            completeReads(entry, nullptr);
+        }
+    });
 
-    auto processFuture = mProcessingThreadPool.submit_task(generateTask);
     if(!async)
-        return processFuture.get();
+        return completed.get();
 
     return 0;
 }
 
+void VirtualFileSystemImpl_MCRAW::submitLoad(size_t filePosition, size_t bytes, Load load) {
+    mIoScheduler->submit(filePosition, [this, filePosition, bytes, load]() {
+        if(mClosing)
+            return;
+
+        // A load that does not fit goes back to the scheduler once budget is returned, the IO thread moves on
+        auto reservation = mRenderBudget.tryReserve(bytes, [this, filePosition, bytes, load]() {
+            if(!mClosing)
+                submitLoad(filePosition, bytes, load);
+        });
+
+        if(reservation)
+            load(std::move(reservation));
+    });
+}
+
+void VirtualFileSystemImpl_MCRAW::completeReads(const Entry& entry, const std::shared_ptr<std::vector<char>>& dngData) {
+    std::vector<PendingRead> reads;
+
+    {
+        std::lock_guard<std::mutex> lock(mPendingReadsMutex);
+
+        auto it = mPendingReads.find(entry);
+        if(it == mPendingReads.end())
+            return;
+
+        reads = std::move(it->second);
+        mPendingReads.erase(it);
+    }
+
+    for(auto& read : reads)
+        read.complete(dngData);
+}
+
+bool VirtualFileSystemImpl_MCRAW::dropAbandonedReads(const Entry& entry) {
+    std::vector<PendingRead> reads;
+
+    {
+        std::lock_guard<std::mutex> lock(mPendingReadsMutex);
+
+        auto it = mPendingReads.find(entry);
+        if(it == mPendingReads.end())
+            return false;
+
+        // Work for the frame goes on as long as one reader still wants it
+        for(const auto& read : it->second) {
+            if(!read.cancelToken || !read.cancelToken->load())
+                return false;
+        }
+
+        reads = std::move(it->second);
+        mPendingReads.erase(it);
+    }
+
+    spdlog::debug("Dropping {}, all readers cancelled", entry.name);
+
+    // Let the next read of the frame start over
+    mCache.markLoadFailed(entry);
+
+    for(auto& read : reads)
+        read.complete(nullptr);
+
+    return true;
+}
+
+std::shared_ptr<void> VirtualFileSystemImpl_MCRAW::trackTask() {
+    {
+        std::lock_guard<std::mutex> lock(mActiveTasksMutex);
+        ++mActiveTasks;
+    }
+
+    return std::shared_ptr<void>(nullptr, [this](void*) {
+        // Notified under the lock, the destructor may return as soon as it can take it
+        std::lock_guard<std::mutex> lock(mActiveTasksMutex);
+
+        --mActiveTasks;
+        mActiveTasksCondition.notify_all();
+    });
+}
+
+void VirtualFileSystemImpl_MCRAW::waitForTasks() {
+    std::unique_lock<std::mutex> lock(mActiveTasksMutex);
+
+    mActiveTasksCondition.wait(lock, [this] { return mActiveTasks == 0; });
+}
+
+size_t VirtualFileSystemImpl_MCRAW::residentBytes() const {
+    // Decoded frames kept for reuse count too, frames in flight are covered by the render budget
+    return mStaticBytes + mBufferPool->pooledBytes();
+}
+
+void VirtualFileSystemImpl_MCRAW::prefetchFrames(size_t frameIndex) {
+    if(!mMappedFile || !mMappedFile->isValid() || frameIndex >= mFrames.size())
+        return;
+
+    size_t begin, end;
+
+    {
+        std::lock_guard<std::mutex> lock(mReadaheadMutex);
+
+        const bool sequential = frameIndex >= mReadaheadStart && frameIndex < mReadaheadEnd;
+
+        if(sequential) {
+            // Still well inside the current window
+            if(frameIndex < mReadaheadStart + (mReadaheadEnd - mReadaheadStart) / 2)
+                return;
+
+            // Reader keeps up with the window, go deeper. The kernel splits a single hint into as many
+            // requests as the device takes, so the queue depth is not limited by the IO thread count.
+            mReadaheadWindow = (std::min<size_t>)(mReadaheadWindow * 2, MAX_READAHEAD_FRAMES);
+            begin = mReadaheadEnd;
+        }
+        else {
+            mReadaheadWindow = MIN_READAHEAD_FRAMES;
+
+            // Without the index, start one frame early to cover the error of the offset estimate
+            begin = (frameIndex > 0 && mFrameRanges.empty()) ? frameIndex - 1 : frameIndex;
+        }
+
+        end = (std::min)(mFrames.size(), frameIndex + mReadaheadWindow);
+
+        mReadaheadStart = frameIndex;
+        mReadaheadEnd = end;
+    }
+
+    if(end <= begin)
+        return;
+
+    if(!mFrameRanges.empty()) {
+        // Frames are stored in capture order, but audio chunks in between may shift them around
+        size_t first = mFrameRanges[begin].first;
+        size_t last = mFrameRanges[begin].second;
+
+        for(size_t i = begin + 1; i < end; i++) {
+            first = (std::min)(first, mFrameRanges[i].first);
+            last = (std::max)(last, mFrameRanges[i].second);
+        }
+
+        mMappedFile->willNeed(first, last - first);
+    }
+    else {
+        // Frames are stored back to back in capture order so estimate the byte range from the frame index
+        const size_t bytesPerFrame = mMappedFile->size() / mFrames.size();
+
+        mMappedFile->willNeed(begin * bytesPerFrame, (end - begin) * bytesPerFrame);
+    }
+}
+
 size_t VirtualFileSystemImpl_MCRAW::generateAudio(
     const Entry& entry,
     const size_t pos,
     const size_t len,
-    void* dst,
-    std::function<void(size_t, int)> result,
-    bool async)
+    void* dst)
 {
     size_t readBytes = 0;
 
@@ -671,7 +1094,8 @@ int VirtualFileSystemImpl_MCRAW::readFile(
     const size_t len,
     void* dst,
     std::function<void(size_t, int)> result,
-    bool async) {
+    bool async,
+    CancelToken cancelToken) {
 
     #ifdef _WIN32
         if(entry.name == "desktop.ini") {
@@ -684,10 +1108,10 @@ int VirtualFileSystemImpl_MCRAW::readFile(
 
     // Requestion audio?
     if(boost::ends_with(entry.name, "wav")) {
-        return generateAudio(entry, pos, len, dst, result, async);
+        return generateAudio(entry, pos, len, dst);
     }
     else if(boost::ends_with(entry.name, "dng")) {
-        return generateFrame(entry, pos, len, dst, result, async);
+        return generateFrame(entry, pos, len, dst, result, async, cancelToken);
     }
 
     return -1;
@@ -721,5 +1145,20 @@ FileInfo VirtualFileSystemImpl_MCRAW::getFileInfo() const {
     };
 }
 
+RenderStats VirtualFileSystemImpl_MCRAW::getRenderStats() const {
+    return RenderStats{
+        mDecodedFrames.load(),
+        mSkippedFrames.load(),
+        mWastedFrames.load()
+    };
+}
+
+void VirtualFileSystemImpl_MCRAW::logRenderStats() const {
+    const auto stats = getRenderStats();
+
+    spdlog::info("{}: decoded {} frames, skipped {} and wasted {} ({:.1f}%) for readers that went away",
+                 mSrcPath, stats.decodedFrames, stats.skippedFrames, stats.wastedFrames, stats.wastedRatio() * 100.0);
+}
+
 } // namespace motioncam
 
@@ -1,10 +1,14 @@
 #include "macos/FuseFileSystemImpl_MacOS.h"
 #include "VirtualFileSystemImpl_MCRAW.h"
 #include "LRUCache.h"
+#include "RenderBudget.h"
+#include "MemoryGovernor.h"
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem.hpp>
 
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <pwd.h>
 #include <unistd.h>
@@ -23,7 +27,13 @@ namespace fs = boost::filesystem;
 namespace motioncam {
 
 constexpr auto CACHE_SIZE = 1024 * 1024 * 1024; // 1 GB cache size
+#ifdef USE_TINYLFU_CACHE
+constexpr auto CACHE_WINDOW_SIZE = CACHE_SIZE / 5; // Recently rendered frames stay cached while they are read
+#endif
 constexpr auto IO_THREADS = 4;
+constexpr auto RENDER_BUDGET_SIZE = 512 * 1024 * 1024; // Memory held by frames being rendered
+constexpr size_t MEMORY_BUDGET = CACHE_SIZE + RENDER_BUDGET_SIZE + 256 * 1024 * 1024; // Including what mounts hold
+constexpr auto INTERRUPT_POLL_INTERVAL = std::chrono::milliseconds(50);
 
 namespace {
 
@@ -84,6 +94,59 @@ struct FuseContext {
     std::atomic_int nextFileHandle;
 };
 
+namespace {
+
+// Reads like a synchronous read, but stops waiting once fuse reports the request as interrupted. The read's
+// token is cancelled then, so a load or render still queued for it is skipped if nobody else wants the frame.
+// Must be called from the thread handling the request.
+int readInterruptible(VirtualFileSystemImpl_MCRAW* fs, const Entry& entry, char* buf, size_t size, off_t offset) {
+    // Only frames are rendered, everything else is answered right away
+    if(!boost::ends_with(entry.name, "dng"))
+        return fs->readFile(entry, offset, size, buf, [](auto, auto) {}, false);
+
+    // A render may finish after an interrupted request has returned, so it copies into memory of its own and
+    // not into the fuse buffer
+    auto data = std::make_shared<std::vector<char>>(size);
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    auto rendered = std::make_shared<std::promise<size_t>>();
+    auto result = rendered->get_future();
+
+    const int readBytes = fs->readFile(
+        entry,
+        offset,
+        size,
+        data->data(),
+        [data, rendered](size_t renderedBytes, int error) { rendered->set_value(renderedBytes); },
+        true,
+        cancelled);
+
+    // Cached data is returned right away and not passed to the callback
+    if(readBytes != 0) {
+        if(readBytes > 0)
+            memcpy(buf, data->data(), readBytes);
+
+        return readBytes;
+    }
+
+    while(result.wait_for(INTERRUPT_POLL_INTERVAL) == std::future_status::timeout) {
+        if(fuse_interrupted()) {
+            spdlog::debug("Read of {} interrupted", entry.name);
+
+            cancelled->store(true);
+            return -EINTR;
+        }
+    }
+
+    // Failed renders and reads past the end return no data, same as a synchronous read
+    const size_t renderedBytes = result.get();
+
+    memcpy(buf, data->data(), renderedBytes);
+
+    return static_cast<int>(renderedBytes);
+}
+
+} // namespace
+
 class Session {
 public:
     Session(const std::string& srcFile, const std::string& dstPath, VirtualFileSystemImpl_MCRAW* fs);
@@ -351,14 +414,7 @@ int Session::fuseRead(const char* path, char* buf, size_t size, off_t offset, st
     if(!entry.has_value())
         return -ENOENT;
 
-    return context->fs->readFile(
-        entry.value(),
-        offset,
-        size,
-        buf,
-        [](auto a, auto b) {},
-        false
-        );
+    return readInterruptible(context->fs, entry.value(), buf, size, offset);
 }
 
 int Session::fuseRelease(const char* path, struct fuse_file_info* fi) {
@@ -371,19 +427,28 @@ FuseFileSystemImpl_MacOs::FuseFileSystemImpl_MacOs() :
     mNextMountId(0),
     mIoThreadPool(std::make_unique<BS::thread_pool>(IO_THREADS)),
     mProcessingThreadPool(std::make_unique<BS::thread_pool>()),
-    mCache(std::make_unique<LRUCache>(CACHE_SIZE))
+#ifdef USE_TINYLFU_CACHE
+    mCache(std::make_unique<LRUCache>(CACHE_SIZE, std::make_unique<TinyLfuPolicy>(), CACHE_WINDOW_SIZE)),
+#else
+    mCache(std::make_unique<LRUCache>(CACHE_SIZE)),
+#endif
+    mRenderBudget(std::make_unique<RenderBudget>(RENDER_BUDGET_SIZE)),
+    mMemoryGovernor(std::make_unique<MemoryGovernor>(*mCache, *mRenderBudget, MEMORY_BUDGET))
 {
     setupLogging();
 }
 
 FuseFileSystemImpl_MacOs::~FuseFileSystemImpl_MacOs() {
-    mMountedFiles.clear();
+    // Queued loads and renders are dropped, the mounts fail the reads they would have answered. Tasks that
+    // are running still use the mounts, so the mounts go once the pools are drained.
+    mIoThreadPool->purge();
+    mProcessingThreadPool->purge();
 
-    // Wait for tasks to complete before we destroy ourselves
     mIoThreadPool->wait();
-
     mProcessingThreadPool->wait();
 
+    mMountedFiles.clear();
+
     spdlog::info("Destroying FuseFileSystemImpl_MacOs()");
 }
 
@@ -425,6 +490,8 @@ MountId FuseFileSystemImpl_MacOs::mount(
                     *mIoThreadPool,
                     *mProcessingThreadPool,
                     *mCache,
+                    *mRenderBudget,
+                    *mMemoryGovernor,
                     settings,
                     srcFile,
                     baseName
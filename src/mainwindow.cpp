@@ -60,6 +60,9 @@ namespace {
         if(ui.quadBayerCheckBox->checkState() == Qt::CheckState::Checked)
             options |= motioncam::RENDER_OPT_INTERPRET_AS_QUAD_BAYER;
 
+        if(ui.adaptiveBitDepthCheckBox->checkState() == Qt::CheckState::Checked)
+            options |= motioncam::RENDER_OPT_ADAPTIVE_BIT_DEPTH;
+
         return options;
     }
 }
@@ -95,6 +98,7 @@ MainWindow::MainWindow(QWidget *parent)
     connect(ui->camModelOverrideCheckBox, &QCheckBox::checkStateChanged, this, &MainWindow::onRenderSettingsChanged);
     connect(ui->logTransformCheckBox, &QCheckBox::checkStateChanged, this, &MainWindow::onRenderSettingsChanged);
     connect(ui->quadBayerCheckBox, &QCheckBox::checkStateChanged, this, &MainWindow::onRenderSettingsChanged);
+    connect(ui->adaptiveBitDepthCheckBox, &QCheckBox::checkStateChanged, this, &MainWindow::onRenderSettingsChanged);
     
     connect(ui->draftQuality, &QComboBox::currentIndexChanged, this, &MainWindow::onDraftModeQualityChanged);
     connect(ui->cfrTarget, &QComboBox::currentTextChanged, this, [this](const QString& text) {
@@ -143,6 +147,7 @@ void MainWindow::saveSettings() {
     settings.setValue("camModelOverrideEnabled", ui->camModelOverrideCheckBox->checkState() == Qt::CheckState::Checked);
     settings.setValue("logTransformEnabled", ui->logTransformCheckBox->checkState() == Qt::CheckState::Checked);
     settings.setValue("interpretAsQBEnabled", ui->quadBayerCheckBox->checkState() == Qt::CheckState::Checked);
+    settings.setValue("adaptiveBitDepthEnabled", ui->adaptiveBitDepthCheckBox->checkState() == Qt::CheckState::Checked);
     settings.setValue("cachePath", mCacheRootFolder);
     settings.setValue("draftQuality", mDraftQuality);
     settings.setValue("cfrTarget", ui->cfrTarget->currentText());
@@ -203,6 +208,9 @@ void MainWindow::restoreSettings() {
     ui->quadBayerCheckBox->setCheckState(
         settings.value("interpretAsQBEnabled").toBool() ? Qt::CheckState::Checked : Qt::CheckState::Unchecked);
 
+    ui->adaptiveBitDepthCheckBox->setCheckState(
+        settings.value("adaptiveBitDepthEnabled").toBool() ? Qt::CheckState::Checked : Qt::CheckState::Unchecked);
+
     mCacheRootFolder = settings.value("cachePath").toString();    
     mDraftQuality = std::max(1, settings.value("draftQuality").toInt());
     mCFRTarget = (!settings.contains("cfrTarget") ? "Prefer Drop Frame" : settings.value("cfrTarget").toString().toStdString());
@@ -730,6 +738,7 @@ void MainWindow::onSetDefaultSettings(bool checked) {
     ui->camModelOverrideCheckBox->setCheckState(Qt::CheckState::Checked);
     ui->logTransformCheckBox->setCheckState(Qt::CheckState::Checked);
     ui->quadBayerCheckBox->setCheckState(Qt::CheckState::Unchecked);
+    ui->adaptiveBitDepthCheckBox->setCheckState(Qt::CheckState::Unchecked);
 
     mDraftQuality = 1;
     mCFRTarget = "Prefer Drop Frame";
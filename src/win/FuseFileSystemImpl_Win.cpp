@@ -4,6 +4,8 @@
 
 #include "VirtualFileSystemImpl_MCRAW.h"
 #include "LRUCache.h"
+#include "RenderBudget.h"
+#include "MemoryGovernor.h"
 
 #include <iostream>
 #include <ntstatus.h>
@@ -31,6 +33,8 @@ namespace motioncam {
 
 constexpr auto CACHE_SIZE = 128 * 1024 * 1024; // Small cache size as we write the files to disk
 constexpr auto IO_THREADS = 4;
+constexpr auto RENDER_BUDGET_SIZE = 512 * 1024 * 1024; // Memory held by frames being rendered
+constexpr size_t MEMORY_BUDGET = CACHE_SIZE + RENDER_BUDGET_SIZE + 256 * 1024 * 1024; // Including what mounts hold
 
 namespace {
 
@@ -108,12 +112,16 @@ protected:
         _In_opt_ PCWSTR DestinationFileName,
         _Inout_ PRJ_NOTIFICATION_PARAMETERS* NotificationParameters) override;
 
+    void CancelCommand(_In_ const PRJ_CALLBACK_DATA* CallbackData) override;
+
 private:
     FileRenderOptions mOptions;
     int mDraftScale;
     std::mutex mOpLock;
     std::unique_ptr<VirtualFileSystemImpl_MCRAW> mFs;
     std::map<GUID, std::unique_ptr<DirInfo>, GUIDComparer> mActiveEnumSessions;
+    std::map<INT32, std::shared_ptr<std::atomic<bool>>> mPendingCommands;
+    std::mutex mPendingCommandsLock;
 };
 
 Session::Session(
@@ -121,6 +129,7 @@ Session::Session(
     std::unique_ptr<VirtualFileSystemImpl_MCRAW> fs) : mFs(std::move(fs))
 {
     SetOptionalMethods(OptionalMethods::Notify);
+    SetOptionalMethods(OptionalMethods::CancelCommand);
 
     // Specify the notifications that we want ProjFS to send to us.  Everywhere under the virtualization
     // root we want ProjFS to tell us when files have been opened, when they're about to be renamed,
@@ -381,9 +390,22 @@ HRESULT Session::GetFileData(_In_ const PRJ_CALLBACK_DATA* callbackData, _In_ UI
         return E_OUTOFMEMORY;
     }
 
+    // Cancelled by ProjFS when the reader gives up on the command
+    auto cancelToken = std::make_shared<std::atomic<bool>>(false);
+
+    {
+        std::lock_guard<std::mutex> lock(mPendingCommandsLock);
+        mPendingCommands[commandId] = cancelToken;
+    }
+
     auto completeTransaction = [this, writeBuffer, byteOffset, length, fileName, commandId, dataStramId](size_t readBytes, int error, bool isAsync) {
         HRESULT hr = S_OK;
 
+        {
+            std::lock_guard<std::mutex> lock(mPendingCommandsLock);
+            mPendingCommands.erase(commandId);
+        }
+
         if(readBytes == length) {
             hr = WriteFileData(&dataStramId, reinterpret_cast<PVOID>(writeBuffer), byteOffset, length);
         }
@@ -411,14 +433,16 @@ HRESULT Session::GetFileData(_In_ const PRJ_CALLBACK_DATA* callbackData, _In_ UI
 
     auto asyncCompleteTransaction = std::bind(completeTransaction, std::placeholders::_1, std::placeholders::_2, true);
 
-    // Read the data asynchronously
+    // Read the data asynchronously. ProjFS only writes data from buffers of PrjAllocateAlignedBuffer, so the
+    // frame is copied into one and cannot be handed over from the cache.
     auto result = mFs->readFile(
         *fsEntry,
         byteOffset,
         length,
         writeBuffer,
         asyncCompleteTransaction,
-        true);
+        true,
+        cancelToken);
 
     if(result > 0) {
         completeTransaction(result, 0, false);
@@ -428,6 +452,16 @@ HRESULT Session::GetFileData(_In_ const PRJ_CALLBACK_DATA* callbackData, _In_ UI
         return HRESULT_FROM_WIN32(ERROR_IO_PENDING);
 }
 
+void Session::CancelCommand(_In_ const PRJ_CALLBACK_DATA* callbackData) {
+    spdlog::debug("CancelCommand(): Command {}", callbackData->CommandId);
+
+    std::lock_guard<std::mutex> lock(mPendingCommandsLock);
+
+    auto it = mPendingCommands.find(callbackData->CommandId);
+    if(it != mPendingCommands.end())
+        it->second->store(true);
+}
+
 HRESULT Session::Notify(
     _In_ const PRJ_CALLBACK_DATA* CallbackData,
     _In_ BOOLEAN IsDirectory,
@@ -542,11 +576,25 @@ FuseFileSystemImpl_Win::FuseFileSystemImpl_Win() :
     mNextMountId(0),
     mIoThreadPool(std::make_unique<BS::thread_pool>(IO_THREADS)),
     mProcessingThreadPool(std::make_unique<BS::thread_pool>()),
-    mCache(std::make_unique<LRUCache>(CACHE_SIZE))
+    mCache(std::make_unique<LRUCache>(CACHE_SIZE)),
+    mRenderBudget(std::make_unique<RenderBudget>(RENDER_BUDGET_SIZE)),
+    mMemoryGovernor(std::make_unique<MemoryGovernor>(*mCache, *mRenderBudget, MEMORY_BUDGET))
 {
     setupLogging();
 }
 
+FuseFileSystemImpl_Win::~FuseFileSystemImpl_Win() {
+    // Queued loads and renders are dropped, the mounts fail the reads they would have answered. Tasks that
+    // are running still use the mounts, so the mounts go once the pools are drained.
+    mIoThreadPool->purge();
+    mProcessingThreadPool->purge();
+
+    mIoThreadPool->wait();
+    mProcessingThreadPool->wait();
+
+    mMountedFiles.clear();
+}
+
 MountId FuseFileSystemImpl_Win::mount(const RenderSettings& settings, const std::string& srcFile, const std::string& dstPath) {
     fs::path srcPath(srcFile);
     std::string extension = srcPath.extension().string();
@@ -560,7 +608,7 @@ MountId FuseFileSystemImpl_Win::mount(const RenderSettings& settings, const std:
             // Extract base name from destination path
             fs::path dstPathObj(dstPath);
             std::string baseName = dstPathObj.filename().string();
-            auto fs = std::make_unique<VirtualFileSystemImpl_MCRAW>(*mIoThreadPool, *mProcessingThreadPool, *mCache, settings, srcFile, baseName);
+            auto fs = std::make_unique<VirtualFileSystemImpl_MCRAW>(*mIoThreadPool, *mProcessingThreadPool, *mCache, *mRenderBudget, *mMemoryGovernor, settings, srcFile, baseName);
             mMountedFiles[mountId] = std::make_unique<Session>(dstPath, std::move(fs));
         }
         catch(std::runtime_error& e) {
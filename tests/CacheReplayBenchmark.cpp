@@ -0,0 +1,108 @@
+// Replays a synthetic read trace against the frame cache and prints hit rates of plain LRU and
+// W-TinyLFU. Readers scrub around a playhead that jumps to a new region now and then, mixed with a
+// sequential scan over the whole clip. Not run as a test, the numbers are for comparing policies.
+
+#include "LRUCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+
+using namespace motioncam;
+
+namespace {
+
+constexpr size_t CACHE_SIZE = 1024ull * 1024 * 1024;
+constexpr size_t FRAME_SIZE = 24 * 1024 * 1024;
+constexpr size_t NUM_FRAMES = 4000;
+constexpr size_t NUM_READS = 200000;
+constexpr double JUMP_PROBABILITY = 0.001;
+constexpr double JUMP_DISTANCE = 800;
+
+struct Result {
+    size_t reads = 0;
+    size_t hits = 0;
+    size_t scrubReads = 0;
+    size_t scrubHits = 0;
+
+    double hitRate() const { return reads > 0 ? 100.0 * hits / reads : 0.0; }
+    double scrubHitRate() const { return scrubReads > 0 ? 100.0 * scrubHits / scrubReads : 0.0; }
+};
+
+Entry frame(size_t index) {
+    Entry entry;
+
+    entry.type = FILE_ENTRY;
+    entry.name = "frame" + std::to_string(index) + ".dng";
+
+    return entry;
+}
+
+// scanShare is the share of reads that belong to the scan, hotFrames how far around the playhead scrubbing goes
+Result replay(LRUCache& cache, double scanShare, size_t hotFrames) {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> aroundPlayhead(0, hotFrames / 3.0);
+
+    auto value = std::make_shared<std::vector<char>>(FRAME_SIZE);
+
+    Result result;
+    size_t scanPosition = 0;
+    double playhead = 1000;
+
+    for(size_t i = 0; i < NUM_READS; i++) {
+        const bool scan = uniform(rng) < scanShare;
+        size_t index;
+
+        if(scan) {
+            index = scanPosition++ % NUM_FRAMES;
+        }
+        else {
+            if(uniform(rng) < JUMP_PROBABILITY)
+                playhead += (uniform(rng) - 0.5) * JUMP_DISTANCE;
+
+            playhead = std::clamp(playhead, 100.0, NUM_FRAMES - 100.0);
+            index = static_cast<size_t>((std::max)(0.0, playhead + aroundPlayhead(rng)));
+        }
+
+        auto entry = frame(index);
+
+        cache.recordAccess(entry);
+
+        const bool hit = cache.get(entry) != nullptr;
+
+        ++result.reads;
+        result.hits += hit;
+
+        if(!scan) {
+            ++result.scrubReads;
+            result.scrubHits += hit;
+        }
+
+        if(!hit)
+            cache.put(entry, value);
+    }
+
+    return result;
+}
+
+} // namespace
+
+int main() {
+    for(double scanShare : { 0.0, 0.3, 0.5, 0.7 }) {
+        for(size_t hotFrames : { 15, 30 }) {
+            LRUCache lru(CACHE_SIZE);
+            LRUCache tinyLfu(CACHE_SIZE, std::make_unique<TinyLfuPolicy>(), CACHE_SIZE / 5);
+
+            const auto a = replay(lru, scanShare, hotFrames);
+            const auto b = replay(tinyLfu, scanShare, hotFrames);
+
+            std::printf("scan %2.0f%% scrub +-%2zu: LRU %5.1f%% (scrub %5.1f%%)  W-TinyLFU %5.1f%% (scrub %5.1f%%)\n",
+                        scanShare * 100, hotFrames,
+                        a.hitRate(), a.scrubHitRate(), b.hitRate(), b.scrubHitRate());
+        }
+    }
+
+    return 0;
+}
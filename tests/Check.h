@@ -0,0 +1,30 @@
+#pragma once
+
+// Minimal checks for the unit tests. A failed check is reported and counted, and the test's main returns
+// the result of finish().
+
+#include <cstdio>
+
+namespace motioncam::test {
+
+inline int failures = 0;
+
+// Number of failed checks reported, non-zero makes the test fail
+inline int finish() {
+    if(failures > 0) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+
+    return 0;
+}
+
+} // namespace motioncam::test
+
+#define CHECK(condition) \
+    do { \
+        if(!(condition)) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++motioncam::test::failures; \
+        } \
+    } while(0)
@@ -0,0 +1,124 @@
+#include "Dither.h"
+#include "Check.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+using namespace motioncam;
+
+namespace {
+
+constexpr int N = DITHER_SIZE * DITHER_SIZE;
+
+// Wrapped frequencies up to this radius count as low frequencies
+constexpr int LOW_FREQUENCY_RADIUS = DITHER_SIZE / 8;
+
+// Share of the tile's energy at low frequencies, relative to white noise which spreads it evenly
+double lowFrequencyEnergyRatio(const DitherTile& tile) {
+    const double mean = std::accumulate(tile.begin(), tile.end(), 0.0) / N;
+    const double pi = std::acos(-1.0);
+
+    double low = 0;
+    double total = 0;
+    int lowBins = 0;
+
+    for(int v = 0; v < DITHER_SIZE; v++) {
+        for(int u = 0; u < DITHER_SIZE; u++) {
+            if(u == 0 && v == 0)
+                continue;
+
+            double re = 0;
+            double im = 0;
+
+            for(int y = 0; y < DITHER_SIZE; y++) {
+                for(int x = 0; x < DITHER_SIZE; x++) {
+                    const double angle = -2.0 * pi * (static_cast<double>(u) * x + static_cast<double>(v) * y) / DITHER_SIZE;
+                    const double value = tile[y * DITHER_SIZE + x] - mean;
+
+                    re += value * std::cos(angle);
+                    im += value * std::sin(angle);
+                }
+            }
+
+            const double energy = re * re + im * im;
+            const int fu = (std::min)(u, DITHER_SIZE - u);
+            const int fv = (std::min)(v, DITHER_SIZE - v);
+
+            total += energy;
+
+            if(fu * fu + fv * fv <= LOW_FREQUENCY_RADIUS * LOW_FREQUENCY_RADIUS) {
+                low += energy;
+                ++lowBins;
+            }
+        }
+    }
+
+    return (low / total) / (static_cast<double>(lowBins) / (N - 1));
+}
+
+void testRanksArePermutation() {
+    for(uint32_t c = 0; c < 4; c++) {
+        auto ranks = voidAndClusterRanks(0x9e3779b9u * (c + 1));
+
+        CHECK(ranks.size() == N);
+
+        std::sort(ranks.begin(), ranks.end());
+
+        std::vector<int> expected(N);
+        std::iota(expected.begin(), expected.end(), 0);
+
+        CHECK(ranks == expected);
+    }
+}
+
+void testTilesArePermutations() {
+    const auto& tiles = ditherTiles();
+
+    // Every tile holds each triangular quantile once, only the order differs
+    auto first = tiles[0];
+    std::sort(first.begin(), first.end());
+
+    CHECK(std::adjacent_find(first.begin(), first.end()) == first.end());
+    CHECK(first.front() > -0.5f && first.back() < 0.5f);
+
+    for(const auto& tile : tiles) {
+        auto sorted = tile;
+        std::sort(sorted.begin(), sorted.end());
+
+        CHECK(sorted == first);
+        CHECK(std::fabs(std::accumulate(tile.begin(), tile.end(), 0.0) / N) < 1e-3);
+    }
+}
+
+void testTilesAreBlueNoise() {
+    for(const auto& tile : ditherTiles()) {
+        // White noise is at 1
+        CHECK(lowFrequencyEnergyRatio(tile) < 0.1);
+    }
+}
+
+void testFixedTilesMatchFloatTiles() {
+    const auto& tiles = ditherTiles();
+    const auto& fixedTiles = ditherTilesFixed();
+
+    for(size_t c = 0; c < tiles.size(); c++) {
+        for(int i = 0; i < N; i++) {
+            const float value = static_cast<float>(fixedTiles[c][i]) / (1 << DITHER_FIXED_POINT_SHIFT);
+
+            CHECK(std::fabs(value - tiles[c][i]) <= 0.5f / (1 << DITHER_FIXED_POINT_SHIFT));
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    testRanksArePermutation();
+    testTilesArePermutations();
+    testTilesAreBlueNoise();
+    testFixedTilesMatchFloatTiles();
+
+    return test::finish();
+}
@@ -0,0 +1,156 @@
+#include "IoScheduler.h"
+#include "Check.h"
+
+#include <BS_thread_pool.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <vector>
+
+using namespace motioncam;
+
+namespace {
+
+// Submits the positions while the only pool thread is held by a job at position 0, then returns the
+// order in which they were dispatched
+std::vector<size_t> replay(const std::vector<size_t>& positions, size_t maxBypass) {
+    BS::thread_pool pool(1);
+    IoScheduler scheduler(pool, maxBypass);
+
+    std::promise<void> release;
+    auto released = release.get_future().share();
+
+    std::mutex mutex;
+    std::vector<size_t> order;
+
+    scheduler.submit(0, [released]() { released.wait(); });
+
+    for(auto position : positions) {
+        scheduler.submit(position, [&mutex, &order, position]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(position);
+        });
+    }
+
+    release.set_value();
+    pool.wait();
+
+    return order;
+}
+
+size_t backwardSeeks(const std::vector<size_t>& order) {
+    size_t seeks = 0;
+
+    for(size_t i = 1; i < order.size(); i++) {
+        if(order[i] < order[i - 1])
+            ++seeks;
+    }
+
+    return seeks;
+}
+
+void testBurstRunsInPositionOrder() {
+    std::vector<size_t> positions(200);
+    std::iota(positions.begin(), positions.end(), 1);
+    std::shuffle(positions.begin(), positions.end(), std::mt19937(1234));
+
+    // Jobs pending together do not count against the bound, however small it is
+    for(size_t maxBypass : { size_t(8), size_t(32), size_t(1000) }) {
+        auto order = replay(positions, maxBypass);
+
+        CHECK(order.size() == positions.size());
+        CHECK(std::is_sorted(order.begin(), order.end()));
+        CHECK(backwardSeeks(order) == 0);
+    }
+}
+
+void testFarJobIsNotStarved() {
+    constexpr size_t maxBypass = 8;
+    constexpr size_t streamEnd = 100;
+
+    BS::thread_pool pool(1);
+    IoScheduler scheduler(pool, maxBypass);
+
+    std::promise<void> release;
+    auto released = release.get_future().share();
+
+    std::mutex mutex;
+    std::vector<size_t> order;
+
+    // Each job of the stream submits the next one just ahead of the head, which keeps a job at the
+    // far end waiting under plain position order
+    std::function<void(size_t)> read = [&](size_t position) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(position);
+        }
+
+        if(position > 0 && position < streamEnd)
+            scheduler.submit(position + 1, [&read, position]() { read(position + 1); });
+    };
+
+    scheduler.submit(0, [released]() { released.wait(); });
+    scheduler.submit(1000, [&read]() { read(0); });
+    scheduler.submit(1, [&read]() { read(1); });
+
+    release.set_value();
+    pool.wait();
+
+    auto far = std::find(order.begin(), order.end(), 0);
+
+    CHECK(order.size() == streamEnd + 1);
+    CHECK(far != order.end());
+
+    // Position 1 was pending together with the far job, the next maxBypass jobs overtake it
+    CHECK(static_cast<size_t>(std::distance(order.begin(), far)) == maxBypass + 1);
+}
+
+void testCancelledJobsDoNotRun() {
+    BS::thread_pool pool(1);
+
+    std::promise<void> release;
+    auto released = release.get_future().share();
+
+    std::atomic<size_t> ran(0);
+    size_t cancelled;
+
+    {
+        IoScheduler scheduler(pool);
+
+        std::promise<void> started;
+
+        scheduler.submit(0, [&started, released]() {
+            started.set_value();
+            released.wait();
+        });
+
+        started.get_future().wait();
+
+        for(size_t position = 1; position <= 10; position++)
+            scheduler.submit(position, [&ran]() { ++ran; });
+
+        cancelled = scheduler.cancel();
+    }
+
+    // Pool tasks of the destroyed scheduler are still queued
+    release.set_value();
+    pool.wait();
+
+    CHECK(cancelled == 10);
+    CHECK(ran == 0);
+}
+
+} // namespace
+
+int main() {
+    testBurstRunsInPositionOrder();
+    testFarJobIsNotStarved();
+    testCancelledJobsDoNotRun();
+
+    return test::finish();
+}
@@ -0,0 +1,85 @@
+#include "SampleTransform.h"
+#include "Check.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+using namespace motioncam;
+
+namespace {
+
+constexpr float SRC_BLACK_LEVEL = 64.0f;
+
+// Largest difference between the integer and the float pipeline over every code of a source bit depth
+struct MaxError {
+    int linear = 0;
+    int log = 0;
+};
+
+MaxError compare(int srcBits, int dstBits, uint32_t codeShift) {
+    const uint32_t srcWhiteLevel = (1u << srcBits) - 1;
+    const float linear = 1.0f / (srcWhiteLevel - SRC_BLACK_LEVEL);
+
+    MaxError error;
+
+    // Linear keeps the source levels, so a code is the sample raised to the black level, limited by adaptive
+    // bit depth and shifted
+    {
+        const uint32_t storedMaxLevel = srcWhiteLevel - 100;
+        const auto table = linearTable(
+            linear, SRC_BLACK_LEVEL, static_cast<float>(srcWhiteLevel), SRC_BLACK_LEVEL, static_cast<float>(storedMaxLevel), codeShift, srcWhiteLevel);
+
+        for(uint32_t v = 0; v <= srcWhiteLevel; v++) {
+            const int expected = static_cast<int>(std::clamp(v, static_cast<uint32_t>(SRC_BLACK_LEVEL), storedMaxLevel) >> codeShift);
+
+            error.linear = (std::max)(error.linear, std::abs(table[v] - expected));
+        }
+    }
+
+    // Log output has no black level and may drop bits, every code is tried with every dither value. The
+    // reference is the float formula the kernels used before the tables.
+    {
+        const float dstWhiteLevel = static_cast<float>((1u << dstBits) - 1);
+        const auto table = logTable(linear, SRC_BLACK_LEVEL, dstWhiteLevel, 0.0f, srcWhiteLevel);
+        const auto& dither = ditherTiles()[0];
+        const auto& ditherFixed = ditherTilesFixed()[0];
+
+        for(uint32_t v = 0; v <= srcWhiteLevel; v++) {
+            const float normalized = std::max(0.0f, linear * (v - SRC_BLACK_LEVEL));
+            const float level = std::log2(1.0f + 60.0f * normalized) / std::log2(61.0f) * dstWhiteLevel;
+
+            for(size_t i = 0; i < dither.size(); i++) {
+                const int expected = static_cast<int>(std::clamp(std::round(level + dither[i]), 0.0f, dstWhiteLevel));
+                const int actual = storeLogFixed(table[v], ditherFixed[i], static_cast<int32_t>(dstWhiteLevel));
+
+                error.log = (std::max)(error.log, std::abs(actual - expected));
+            }
+        }
+    }
+
+    return error;
+}
+
+void testFixedPointMatchesFloat() {
+    for(int srcBits = 10; srcBits <= 12; srcBits++) {
+        for(int dstBits = srcBits - 4; dstBits <= srcBits; dstBits += 2) {
+            for(uint32_t codeShift : { 0u, 2u }) {
+                const auto error = compare(srcBits, dstBits, codeShift);
+
+                // The linear tables hold the exact codes. Log codes may differ by one where the fixed point dither
+                // rounds a value that sits on a rounding boundary to the other side.
+                CHECK(error.linear == 0);
+                CHECK(error.log <= 1);
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    testFixedPointMatchesFloat();
+
+    return test::finish();
+}